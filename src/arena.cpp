@@ -0,0 +1,119 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+Arena::Arena(size_t block_size, bool huge_pages) :
+	used_{ 0 }, block_size_{ std::max<size_t>(block_size, 64) }, huge_pages_{ huge_pages }, stats_{ 0, 0, 0, 0, 0, 0, 0 }
+{
+}
+
+Arena::~Arena()
+{
+	for (auto block = blocks_.begin(); block != blocks_.end(); block++)
+		freeBlock(*block);
+}
+
+void * Arena::allocate(size_t bytes, size_t alignment)
+{
+	size_t start = blocks_.empty() ? 0 : (reinterpret_cast<uintptr_t>(blocks_.back().data_) + used_ + alignment - 1) / alignment * alignment
+		- reinterpret_cast<uintptr_t>(blocks_.back().data_);
+	if (blocks_.empty() || start + bytes > blocks_.back().size_) {
+		addBlock(bytes + alignment);
+		start = (reinterpret_cast<uintptr_t>(blocks_.back().data_) + alignment - 1) / alignment * alignment - reinterpret_cast<uintptr_t>(blocks_.back().data_);
+	}
+
+	stats_.allocations_++;
+	stats_.bytes_allocated_ += bytes;
+	stats_.bytes_in_use_ += start + bytes - used_;
+	used_ = start + bytes;
+	return blocks_.back().data_ + start;
+}
+
+void Arena::reserve(size_t bytes)
+{
+	if (blocks_.empty() || used_ + bytes > blocks_.back().size_)
+		addBlock(bytes);
+}
+
+void Arena::reset()
+{
+	if (blocks_.size() > 1) {
+		size_t total = 0;
+		for (auto block = blocks_.begin(); block != blocks_.end(); block++) {
+			total += block->size_;
+			freeBlock(*block);
+		}
+		blocks_.clear();
+		stats_.blocks_ = 0;
+		stats_.huge_page_blocks_ = 0;
+		stats_.bytes_reserved_ = 0;
+		addBlock(total);
+	}
+	used_ = 0;
+	stats_.bytes_in_use_ = 0;
+	stats_.resets_++;
+}
+
+const Arena::Stats & Arena::stats() const
+{
+	return stats_;
+}
+
+void Arena::addBlock(size_t min_size)
+{
+	// The rest of the current block is wasted
+	if (!blocks_.empty())
+		stats_.bytes_in_use_ += blocks_.back().size_ - used_;
+
+	Block block = allocateBlock(std::max(min_size, block_size_), huge_pages_);
+	blocks_.push_back(block);
+	used_ = 0;
+	stats_.blocks_++;
+	stats_.bytes_reserved_ += block.size_;
+	if (block.huge_)
+		stats_.huge_page_blocks_++;
+}
+
+Arena::Block Arena::allocateBlock(size_t size, bool huge_pages)
+{
+#ifdef __linux__
+	if (huge_pages && size >= HUGE_PAGE_SIZE) {
+		// Map one huge page more and cut the region down to huge page boundaries, otherwise the kernel cannot use huge pages at its ends
+		size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void* mapped = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapped != MAP_FAILED) {
+			uintptr_t begin = reinterpret_cast<uintptr_t>(mapped);
+			uintptr_t aligned = (begin + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+			if (aligned > begin)
+				munmap(mapped, aligned - begin);
+			munmap(reinterpret_cast<void*>(aligned + size), begin + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+			madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+			return Block{ reinterpret_cast<uint8_t*>(aligned), size, true };
+		}
+	}
+#endif
+	uint8_t* data = static_cast<uint8_t*>(std::malloc(size));
+	if (data == nullptr)
+		throw std::bad_alloc{};
+	return Block{ data, size, false };
+}
+
+void Arena::freeBlock(const Block & block)
+{
+#ifdef __linux__
+	if (block.huge_) {
+		munmap(block.data_, block.size_);
+		return;
+	}
+#endif
+	std::free(block.data_);
+}
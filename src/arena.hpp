@@ -0,0 +1,144 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <new>
+
+/// @brief Bump allocator for memory with a common lifetime, e.g. the geometry of a mesh or the temporaries of a tile.
+/// Allocations only advance a pointer inside a block, memory is given back all at once by reset() or the destructor.
+/// With huge pages, blocks of 2 MB and more are backed by transparent huge pages where the system supports it.
+class Arena
+{
+public:
+	struct Stats {
+		size_t allocations_; // since construction
+		size_t bytes_allocated_; // since construction
+		size_t bytes_in_use_; // since the last reset, including alignment padding
+		size_t bytes_reserved_; // size of the blocks held
+		size_t blocks_; // held
+		size_t huge_page_blocks_; // held
+		size_t resets_;
+	};
+
+	explicit Arena(size_t block_size = 64 * 1024, bool huge_pages = false);
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+	template<class T>
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	// Array of count value initialized elements, their destructors are never called
+	template<class T>
+	T* allocateArray(size_t count)
+	{
+		T* data = allocate<T>(count);
+		for (size_t i = 0; i < count; i++)
+			new (data + i) T();
+		return data;
+	}
+
+	// Make sure allocations of up to bytes in total following this call are taken from a single block
+	void reserve(size_t bytes);
+
+	// Forget all allocations but keep the memory for the next ones, several blocks are merged into one large enough for all of them
+	void reset();
+
+	const Stats& stats() const;
+
+private:
+	struct Block {
+		uint8_t* data_;
+		size_t size_;
+		bool huge_;
+	};
+
+	// Start a new block with at least min_size bytes
+	void addBlock(size_t min_size);
+
+	static Block allocateBlock(size_t size, bool huge_pages);
+	static void freeBlock(const Block& block);
+
+	std::vector<Block> blocks_;
+	size_t used_; // of the last block
+	size_t block_size_;
+	bool huge_pages_;
+	Stats stats_;
+};
+
+
+/// @brief STL allocator taking its memory from an arena, deallocation is a no-op.
+template<class T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	ArenaAllocator(Arena* arena) : arena_{ arena } {}
+
+	template<class U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena_{ other.arena() } {}
+
+	T* allocate(size_t count)
+	{
+		return arena_->allocate<T>(count);
+	}
+
+	void deallocate(T*, size_t) {}
+
+	Arena* arena() const
+	{
+		return arena_;
+	}
+
+private:
+	Arena* arena_;
+};
+
+template<class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena() == b.arena();
+}
+
+template<class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena() != b.arena();
+}
+
+template<class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+
+/// @brief Fixed size array in memory owned by someone else, e.g. an arena or a mapped file.
+template<class T>
+class ArrayView
+{
+public:
+	ArrayView() : data_{ nullptr }, size_{ 0 } {}
+	ArrayView(T* data, size_t size) : data_{ data }, size_{ size } {}
+
+	T* data() { return data_; }
+	const T* data() const { return data_; }
+	size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	T* begin() { return data_; }
+	T* end() { return data_ + size_; }
+	const T* begin() const { return data_; }
+	const T* end() const { return data_ + size_; }
+
+	T& operator[](size_t i) { return data_[i]; }
+	const T& operator[](size_t i) const { return data_[i]; }
+
+private:
+	T* data_;
+	size_t size_;
+};
@@ -0,0 +1,341 @@
+#define _USE_MATH_DEFINES
+#include <iostream>
+#include <Eigen/Dense>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "global.hpp"
+#include "camera.hpp"
+#include "box3.hpp"
+#include "sceneobject.hpp"
+#include "meshdata.hpp"
+#include "scene.hpp"
+#include "lighting.hpp"
+
+// Microbenchmarks of the intersection and shading kernels on fixed sets of random rays, no model files are needed.
+// Every kernel is timed on a set of rays which all hit and on one which all miss, the results are printed as tab separated values.
+
+struct BenchOptions {
+	size_t rays = 4096;
+	double seconds = 0.1; // minimum time of a single run
+	int runs = 5; // the fastest run is reported
+	unsigned seed = 1;
+};
+
+void printUsage(const char* program)
+{
+	std::cout << "Usage: " << program << " [options]\n"
+		"  --rays N                size of every ray set (default 4096)\n"
+		"  --seconds S             minimum time of a single run (default 0.1)\n"
+		"  --runs N                number of runs, the fastest one is reported (default 5)\n"
+		"  --seed N                seed of the random ray sets (default 1)\n";
+}
+
+bool parseOptions(int argc, char* argv[], BenchOptions* opt)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--help")
+			return false;
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		std::string value = argv[++i];
+		try {
+			if (arg == "--rays")
+				opt->rays = std::stoul(value);
+			else if (arg == "--seconds")
+				opt->seconds = std::stod(value);
+			else if (arg == "--runs")
+				opt->runs = std::stoi(value);
+			else if (arg == "--seed")
+				opt->seed = static_cast<unsigned>(std::stoul(value));
+			else {
+				std::cout << "Unknown option " << arg << std::endl;
+				return false;
+			}
+		}
+		catch (const std::exception&) {
+			std::cout << "Invalid value " << value << " for " << arg << std::endl;
+			return false;
+		}
+	}
+	return opt->rays > 0 && opt->seconds > 0 && opt->runs > 0;
+}
+
+/// @brief Uniform random numbers which are the same on every platform, unlike the std distributions.
+class Random
+{
+public:
+	explicit Random(unsigned seed) : engine_{ seed } {}
+
+	// In [min,max)
+	double uniform(double min = 0, double max = 1)
+	{
+		return min + (max - min) * (engine_() / 4294967296.0);
+	}
+
+	// Random point inside a ball around the origin
+	Vec3 inBall(double radius)
+	{
+		Vec3 p;
+		do {
+			p = Vec3{ uniform(-1, 1), uniform(-1, 1), uniform(-1, 1) };
+		} while (p.squaredNorm() > 1);
+		return radius * p;
+	}
+
+private:
+	std::mt19937 engine_;
+};
+
+// Keeps the results of the kernels alive so the compiler cannot remove the calls
+static volatile double sink;
+
+// Ray from a random point above the unit square around the z axis towards the target
+Ray rayTo(Random& rnd, const Vec3& target)
+{
+	Vec3 pos{ rnd.uniform(-1, 1), rnd.uniform(-1, 1), 5 };
+	return Ray{ pos, (target - pos).normalized() };
+}
+
+// Point in the plane z = 0 with a maximum norm in [2,4], a ray from above the unit square to it stays at least 1.4 away
+// from the z axis below z = 1 and misses every object inside the unit cube
+Vec3 missTarget(Random& rnd)
+{
+	double r = rnd.uniform(2, 4);
+	double s = rnd.uniform(-r, r);
+	switch (static_cast<int>(rnd.uniform(0, 4))) {
+	case 0: return Vec3{ r, s, 0 };
+	case 1: return Vec3{ -r, s, 0 };
+	case 2: return Vec3{ s, r, 0 };
+	default: return Vec3{ s, -r, 0 };
+	}
+}
+
+struct Result {
+	size_t ops;
+	double ns_per_op;
+};
+
+// Call kernel(i) for all i in [0,count) until a run takes at least the minimum time, the fastest run of several is taken
+template<class Kernel>
+Result measure(const BenchOptions& opt, size_t count, Kernel kernel)
+{
+	using Clock = std::chrono::steady_clock;
+	double best = 0;
+	size_t ops = 0;
+	for (int run = 0; run < opt.runs; run++) {
+		size_t n = 0;
+		double acc = 0;
+		Clock::time_point start = Clock::now();
+		double elapsed;
+		do {
+			for (size_t i = 0; i < count; i++)
+				acc += kernel(i);
+			n += count;
+			elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		} while (elapsed < opt.seconds);
+		sink = acc;
+		double ns = elapsed * 1e9 / n;
+		if (run == 0 || ns < best)
+			best = ns;
+		ops += n;
+	}
+	return Result{ ops, best };
+}
+
+void printHeader()
+{
+	std::printf("kernel\tcase\tops\tns_per_op\trays_per_second\thits\n");
+}
+
+// hits is the number of rays of the set which hit, -1 if the kernel has no hits
+void printResult(const char* kernel, const char* name, const Result& result, long long hits)
+{
+	std::printf("%s\t%s\t%zu\t%.3f\t%.0f\t", kernel, name, result.ops, result.ns_per_op, 1e9 / result.ns_per_op);
+	if (hits < 0)
+		std::printf("-\n");
+	else
+		std::printf("%lld\n", hits);
+	std::fflush(stdout);
+}
+
+void benchSphere(const BenchOptions& opt)
+{
+	Sphere sphere{ Util::createSE3(0, 0, 0, 0, 0, 0), Material::Generator(MaterialColor::White, 0), 1 };
+	sphere.computeScale();
+
+	Random rnd{ opt.seed };
+	std::vector<Ray> hit_rays, miss_rays;
+	for (size_t i = 0; i < opt.rays; i++) {
+		hit_rays.push_back(rayTo(rnd, rnd.inBall(0.9)));
+		miss_rays.push_back(rayTo(rnd, missTarget(rnd)));
+	}
+
+	const char* names[] = { "hit", "miss" };
+	const std::vector<Ray>* sets[] = { &hit_rays, &miss_rays };
+	for (int s = 0; s < 2; s++) {
+		const std::vector<Ray>& rays = *sets[s];
+		Intersection is{ Vec3::Zero(), Vec3::Zero(), 0, nullptr };
+		long long hits = 0;
+		for (const Ray& r : rays)
+			hits += sphere.intersect(r, &is);
+		Result result = measure(opt, rays.size(), [&](size_t i) {
+			return sphere.intersect(rays[i], &is) ? is.distance() : 0.0;
+		});
+		printResult("Sphere::intersect", names[s], result, hits);
+	}
+}
+
+void benchTriangle(const BenchOptions& opt)
+{
+	// Face 0 of the pyramid lies in the plane z = 0 with the corners (0,0,0), (1,0,0) and (0,1,0)
+	std::shared_ptr<TriangularMesh::MeshData> mesh = TriangularMesh::MeshData::createPyramid();
+
+	Random rnd{ opt.seed };
+	std::vector<Ray> hit_rays, miss_rays;
+	for (size_t i = 0; i < opt.rays; i++) {
+		// Targets at least 0.01 away from the edge x + y = 1, inside and outside the triangle
+		double x, y;
+		do {
+			x = rnd.uniform(0.01, 0.99);
+			y = rnd.uniform(0.01, 0.99);
+		} while (x + y > 0.99);
+		hit_rays.push_back(rayTo(rnd, Vec3{ x, y, 0 }));
+		do {
+			x = rnd.uniform(0.01, 0.99);
+			y = rnd.uniform(0.01, 0.99);
+		} while (x + y < 1.01);
+		miss_rays.push_back(rayTo(rnd, Vec3{ x, y, 0 }));
+	}
+
+	const char* names[] = { "hit", "miss" };
+	const std::vector<Ray>* sets[] = { &hit_rays, &miss_rays };
+	for (int s = 0; s < 2; s++) {
+		const std::vector<Ray>& rays = *sets[s];
+		double distance;
+		Vec2 uv;
+		long long hits = 0;
+		for (const Ray& r : rays)
+			hits += mesh->calcTriIntersect(0, r, &distance, &uv);
+		Result result = measure(opt, rays.size(), [&](size_t i) {
+			return mesh->calcTriIntersect(0, rays[i], &distance, &uv) ? distance : 0.0;
+		});
+		printResult("MeshData::calcTriIntersect", names[s], result, hits);
+	}
+}
+
+void benchBox(const BenchOptions& opt)
+{
+	Box3 box{ Vec3::Zero(), Vec3::UnitX(), Vec3::UnitY(), Vec3::UnitZ(), 1, 1, 1 };
+
+	Random rnd{ opt.seed };
+	std::vector<Ray> hit_rays, miss_rays;
+	for (size_t i = 0; i < opt.rays; i++) {
+		hit_rays.push_back(rayTo(rnd, Vec3{ rnd.uniform(-0.9, 0.9), rnd.uniform(-0.9, 0.9), rnd.uniform(-0.9, 0.9) }));
+		miss_rays.push_back(rayTo(rnd, missTarget(rnd)));
+	}
+
+	const char* names[] = { "hit", "miss" };
+	const std::vector<Ray>* sets[] = { &hit_rays, &miss_rays };
+	for (int s = 0; s < 2; s++) {
+		const std::vector<Ray>& rays = *sets[s];
+		long long hits = 0;
+		for (const Ray& r : rays)
+			hits += box.intersect(r);
+		Result result = measure(opt, rays.size(), [&](size_t i) {
+			return box.intersect(rays[i]) ? 1.0 : 0.0;
+		});
+		printResult("Box3::intersect", names[s], result, hits);
+	}
+}
+
+void benchCamera(const BenchOptions& opt)
+{
+	Camera cam{ 640, 480, 500 };
+	cam.transform() = Util::createSE3(Util::degToRad(-90), 0, 0, 0, -5, 0);
+
+	Random rnd{ opt.seed };
+	std::vector<Vec2> pixels;
+	for (size_t i = 0; i < opt.rays; i++)
+		pixels.push_back(Vec2{ rnd.uniform(0, 640), rnd.uniform(0, 480) });
+
+	Result result = measure(opt, pixels.size(), [&](size_t i) {
+		return cam.computeRay(pixels[i]).dir().x();
+	});
+	printResult("Camera::computeRay", "all", result, -1);
+}
+
+void benchShading(const BenchOptions& opt)
+{
+	// A point light straight above a small sphere casting its shadow onto a large one, the shaded points are on top of the large sphere.
+	// Shadow rays of points near the z axis hit the small sphere, those of points far away reach the light.
+	Sphere ground{ Util::createSE3(0, 0, 0, 0, 0, -100), Material::Generator(MaterialColor::White, MaterialOption::Shiny), 100 };
+	Sphere occluder{ Util::createSE3(0, 0, 0, 0, 0, 2), Material::Generator(MaterialColor::Red, MaterialOption::Shiny), 0.5 };
+	SceneObjects objects{ &ground, &occluder };
+	for (SceneObject* obj : objects) {
+		obj->computeScale();
+		obj->material().classify();
+	}
+	Scene scene;
+	scene.build(objects);
+
+	Vec3 light_pos{ 0, 0, 5 };
+	Lighting lighting{ RGBd{ 0.1, 0.1, 0.1 } };
+	lighting.pointLights().push_back(PointLight{ light_pos, RGBd{ 1, 1, 1 }, 1, RGBd{ 1, 1, 1 }, 1 });
+	lighting.prepare(scene, 1);
+
+	Random rnd{ opt.seed };
+	std::vector<Intersection> shadowed, lit;
+	while (shadowed.size() < opt.rays || lit.size() < opt.rays) {
+		double r = rnd.uniform(0, 4), a = rnd.uniform(0, 2 * M_PI);
+		if (r >= 0.2 && r < 3)
+			continue;
+		std::vector<Intersection>& set = r < 0.2 ? shadowed : lit;
+		if (set.size() >= opt.rays)
+			continue;
+		Intersection is{ Vec3::Zero(), Vec3::Zero(), 0, nullptr };
+		if (ground.intersect(Ray{ Vec3{ r * std::cos(a), r * std::sin(a), 10 }, -Vec3::UnitZ() }, &is))
+			set.push_back(is);
+	}
+
+	Vec3 cam_pos{ 0, -5, 5 };
+	const char* names[] = { "hit", "miss" };
+	const std::vector<Intersection>* sets[] = { &shadowed, &lit };
+	for (int s = 0; s < 2; s++) {
+		const std::vector<Intersection>& points = *sets[s];
+		long long hits = 0;
+		for (const Intersection& is : points) {
+			Vec3 to_light = light_pos - is.pos();
+			hits += scene.anyHit(Ray{ is.pos() + EPS * to_light, to_light.normalized() }, to_light.norm()) != nullptr;
+		}
+		Result result = measure(opt, points.size(), [&](size_t i) {
+			return lighting.computeColor(points[i], cam_pos, scene).sum();
+		});
+		printResult("Lighting::computeColor", names[s], result, hits);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions opt;
+	if (!parseOptions(argc, argv, &opt)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	printHeader();
+	benchSphere(opt);
+	benchTriangle(opt);
+	benchBox(opt);
+	benchCamera(opt);
+	benchShading(opt);
+	return 0;
+}
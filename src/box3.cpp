@@ -55,3 +55,19 @@ const Vec3 & Box3::center() const
 	return center_;
 }
 
+Vec3 Box3::lengths() const
+{
+	return Vec3{ length_u_, length_v_, length_w_ };
+}
+
+std::vector<Vec3> Box3::corners() const
+{
+	std::vector<Vec3> corners;
+	for (int i = 0; i < 8; i++) {
+		double su = (i & 1) ? 1 : -1;
+		double sv = (i & 2) ? 1 : -1;
+		double sw = (i & 4) ? 1 : -1;
+		corners.push_back(center_ + su * length_u_ * u_ + sv * length_v_ * v_ + sw * length_w_ * w_);
+	}
+	return corners;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "global.hpp"
-#include "sceneobject.hpp"
+#include "camera.hpp"
+#include <vector>
 
 class Box3
 {
@@ -12,6 +13,11 @@ public:
 	Vec3& center();
 	const Vec3& center() const;
 
+	// Half lengths along u, v and w
+	Vec3 lengths() const;
+
+	std::vector<Vec3> corners() const;
+
 private:
 	Vec3 center_;
 
@@ -1,10 +1,13 @@
 #include "camera.hpp"
 #include <iostream>
+#include <cmath>
+#include <algorithm>
 
 
 Camera::Camera(int screen_width, int screen_height, double focal_length) : 
-	screen_width_{ screen_width }, screen_height_{ screen_height }, focal_length_{focal_length}
+	screen_width_{ screen_width }, screen_height_{ screen_height }, focal_length_{focal_length}, rays_prepared_{ false }
 {
+	clearCropWindow();
 	calculateProjectionMatrix();
 }
 
@@ -15,22 +18,44 @@ Camera::~Camera()
 
 Ray Camera::computeRay(Vec2 pixel)
 {
-	// X1 = Kf \ x_hom
-	Vec3 point_on_screen = pixel.homogeneous();
-	point_on_screen = projection_matrix_qr_.solve(point_on_screen);
-	//std::cout << projection_matrix_ << std::endl;
+	if (!rays_prepared_)
+		prepareRays();
+	return planeRay(pixel.x(), pixel.y());
+}
 
-	Ray r{ Vec3::Zero(), Vec3::Zero() };
+void Camera::computeRays(int start_x, int end_x, int start_y, int end_y, ArenaVector<Ray>* rays)
+{
+	if (!rays_prepared_)
+		prepareRays();
+	rays->clear();
+	rays->reserve((end_x - start_x) * (end_y - start_y));
+	for (int y = start_y; y < end_y; y++) {
+		for (int x = start_x; x < end_x; x++)
+			rays->push_back(planeRay(x, y));
+	}
+}
 
-	// point in world coordinates
-	r.pos() = (tf_ * point_on_screen.homogeneous()).topRows(3);
-	//std::cout << "ray_pos" <<std::endl << r.pos() << std::endl;
+void Camera::prepareRays()
+{
+	// The point on the screen X1 = Kf \ x_hom is affine in the pixel coordinates,
+	// so its world position is plane_origin_ + x * plane_dx_ + y * plane_dy_
+	Mat33 rotation = tf_.matrix().topLeftCorner(3, 3);
+	Vec3 origin_on_screen = projection_matrix_qr_.solve(Vec3(0, 0, 1));
+	plane_origin_ = (tf_ * origin_on_screen.homogeneous()).topRows(3);
+	plane_dx_ = rotation * Vec3(1 / focal_length_, 0, 0);
+	plane_dy_ = rotation * Vec3(0, 1 / focal_length_, 0);
+	rays_prepared_ = true;
+}
 
-	// calculate direction in world coordinates
-	r.dir() = tf_.matrix().topLeftCorner(3, 3) * point_on_screen.normalized();
-	//std::cout << "ray_dir" << std::endl << r.dir() << std::endl;
+Ray Camera::planeRay(double x, double y) const
+{
+	Vec3 pos = plane_origin_ + x * plane_dx_ + y * plane_dy_;
 
-	return r;
+	// The direction is the normalized point on the screen in camera coordinates, rotated to world coordinates
+	double screen_x = (x - screen_width_ / 2) / focal_length_;
+	double screen_y = (y - screen_height_ / 2) / focal_length_;
+	double inv_norm = 1 / std::sqrt(screen_x * screen_x + screen_y * screen_y + 1);
+	return Ray{ pos, (pos - tf_.translation()) * inv_norm };
 }
 
 Vec2 Camera::projectPointToPixel(Vec3 point)
@@ -46,6 +71,19 @@ Vec2 Camera::projectPointToPixel(Vec3 point)
 	return pixel;
 }
 
+bool Camera::projectBoundsToPixels(const AABB3 & bounds, AABB2 * pixels) const
+{
+	SE3 world2cam = tf_.inverse();
+	pixels->setEmpty();
+	for (int i = 0; i < 8; i++) {
+		Vec3 point = (world2cam * bounds.corner(static_cast<AABB3::CornerType>(i)).homogeneous()).topRows(3);
+		if (point[2] <= EPS)
+			return false;
+		pixels->extend(Vec2{ (projection_matrix_ * (point / point[2])).topRows(2) });
+	}
+	return true;
+}
+
 Vec3 Camera::projectPixelToWorld(Vec2 pixel, double distance)
 {
 	// X1 = Kf \ x_hom
@@ -58,9 +96,20 @@ Vec3 Camera::projectPixelToWorld(Vec2 pixel, double distance)
 
 SE3 & Camera::transform()
 {
+	rays_prepared_ = false;
 	return tf_;
 }
 
+const SE3 & Camera::transform() const
+{
+	return tf_;
+}
+
+const Mat33 & Camera::projectionMatrix() const
+{
+	return projection_matrix_;
+}
+
 int Camera::screenWidth()
 {
 	return screen_width_;
@@ -71,12 +120,76 @@ int Camera::screenHeight()
 	return screen_height_;
 }
 
+double Camera::focalLength()
+{
+	return focal_length_;
+}
+
+void Camera::setResolution(int screen_width, int screen_height)
+{
+	screen_width_ = screen_width;
+	screen_height_ = screen_height;
+	clearCropWindow();
+	calculateProjectionMatrix();
+}
+
+void Camera::setFocalLength(double focal_length)
+{
+	focal_length_ = focal_length;
+	calculateProjectionMatrix();
+}
+
+void Camera::setCropWindow(int x, int y, int width, int height)
+{
+	crop_x_ = std::min(std::max(x, 0), screen_width_);
+	crop_y_ = std::min(std::max(y, 0), screen_height_);
+	crop_width_ = std::max(0, std::min(x + width, screen_width_) - crop_x_);
+	crop_height_ = std::max(0, std::min(y + height, screen_height_) - crop_y_);
+}
+
+void Camera::clearCropWindow()
+{
+	crop_x_ = 0;
+	crop_y_ = 0;
+	crop_width_ = screen_width_;
+	crop_height_ = screen_height_;
+}
+
+int Camera::cropX()
+{
+	return crop_x_;
+}
+
+int Camera::cropY()
+{
+	return crop_y_;
+}
+
+int Camera::cropWidth()
+{
+	return crop_width_;
+}
+
+int Camera::cropHeight()
+{
+	return crop_height_;
+}
+
+uint64_t Camera::hash(uint64_t seed) const
+{
+	seed = Util::hash64(tf_.data(), sizeof(double) * 16, seed);
+	int size[6] = { screen_width_, screen_height_, crop_x_, crop_y_, crop_width_, crop_height_ };
+	seed = Util::hash64(size, sizeof(size), seed);
+	return Util::hash64(&focal_length_, sizeof(focal_length_), seed);
+}
+
 void Camera::calculateProjectionMatrix()
 {
 	projection_matrix_ << focal_length_, 0, screen_width_ / 2,
 		0, focal_length_, screen_height_ / 2,
 		0, 0, 1;
 	projection_matrix_qr_ = projection_matrix_.colPivHouseholderQr();
+	rays_prepared_ = false;
 }
 
 Ray::Ray(const Vec3 & position, const Vec3 & direction) : 
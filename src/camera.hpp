@@ -1,6 +1,8 @@
 #pragma once
 
 #include "global.hpp"
+#include "arena.hpp"
+#include <vector>
 
 class Ray
 {
@@ -25,23 +27,63 @@ public:
 
 	Ray computeRay(Vec2 pixel);
 
+	// Rays of all pixels [start_x,end_x) x [start_y,end_y), row by row
+	void computeRays(int start_x, int end_x, int start_y, int end_y, ArenaVector<Ray>* rays);
+
+	// Precompute the image plane in world coordinates. Done automatically after the pose changed,
+	// call it before generating rays from several threads.
+	void prepareRays();
+
 	Vec2 projectPointToPixel(Vec3 point);
 
+	// Pixel rectangle covering the projection of a box in world coordinates, false if the box is not completely in front of the camera
+	bool projectBoundsToPixels(const AABB3& bounds, AABB2* pixels) const;
+
 	Vec3 projectPixelToWorld(Vec2 pixel, double distance);
 
 	SE3& transform();
+	const SE3& transform() const;
+
+	// Maps points on the image plane z = 1 in camera coordinates to homogeneous pixel coordinates
+	const Mat33& projectionMatrix() const;
 
 	int screenWidth();
 
 	int screenHeight();
 
+	double focalLength();
+
+	// Changing the resolution resets the crop window to the full frame
+	void setResolution(int screen_width, int screen_height);
+
+	void setFocalLength(double focal_length);
+
+	// Only render the sub-rectangle of the frame starting at pixel (x,y), it is clipped to the frame
+	void setCropWindow(int x, int y, int width, int height);
+	void clearCropWindow();
+
+	// Crop window in pixels of the full frame, the full frame if no crop window is set
+	int cropX();
+	int cropY();
+	int cropWidth();
+	int cropHeight();
+
+	// Hash of pose and intrinsics
+	uint64_t hash(uint64_t seed) const;
+
 private:
 
 	void calculateProjectionMatrix();
 
+	// Ray through a pixel from the precomputed image plane
+	Ray planeRay(double x, double y) const;
+
 	int screen_width_;
 	int screen_height_;
 
+	int crop_x_, crop_y_;
+	int crop_width_, crop_height_;
+
 	/// @brief size of world unit length in pixels
 	double focal_length_;
 
@@ -50,5 +92,11 @@ private:
 
 	Mat33 projection_matrix_;
 	Eigen::ColPivHouseholderQR<Mat33> projection_matrix_qr_;
+
+	/// @brief image plane in world coordinates: point of pixel (0,0) and offsets per pixel in x and y
+	bool rays_prepared_;
+	Vec3 plane_origin_;
+	Vec3 plane_dx_;
+	Vec3 plane_dy_;
 };
 
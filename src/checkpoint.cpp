@@ -0,0 +1,163 @@
+#include "checkpoint.hpp"
+#include <iostream>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+const char CHECKPOINT_MAGIC[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '\n', 0 };
+const uint32_t CHECKPOINT_VERSION = 1;
+const uint32_t TILE_MAGIC = 0x454c4954; // "TILE"
+
+// Cut off a partially written record
+static bool truncateFile(const std::string& path, std::streamoff size)
+{
+#ifdef _WIN32
+	int fd;
+	if (_sopen_s(&fd, path.c_str(), _O_RDWR | _O_BINARY, _SH_DENYNO, 0) != 0)
+		return false;
+	bool ok = _chsize_s(fd, size) == 0;
+	_close(fd);
+	return ok;
+#else
+	return truncate(path.c_str(), size) == 0;
+#endif
+}
+
+CheckpointSink::CheckpointSink(const std::string & path, TileSink * target, double flush_interval) :
+	TileSink{ target->format() }, path_{ path }, target_{ target }, flush_interval_{ flush_interval }
+{
+}
+
+bool CheckpointSink::begin(int width, int height, int tile_width, int tile_height, uint64_t frame_key)
+{
+	if (!target_->begin(width, height, tile_width, tile_height, frame_key))
+		return false;
+
+	Header header;
+	std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+	header.version = CHECKPOINT_VERSION;
+	header.width = width;
+	header.height = height;
+	header.tile_width = tile_width;
+	header.tile_height = tile_height;
+	header.format = static_cast<int32_t>(format_);
+	header.frame_key = frame_key;
+
+	// Resume from an existing log of the same frame
+	done_.clear();
+	std::streamoff valid_size = 0;
+	std::ifstream existing{ path_, std::ios::binary };
+	if (existing) {
+		Header old;
+		if (existing.read(reinterpret_cast<char*>(&old), sizeof(old)) && std::memcmp(&old, &header, sizeof(header)) == 0) {
+			valid_size = replay(existing);
+			std::cout << "Restored " << done_.size() << " tiles from checkpoint " << path_ << std::endl;
+		}
+		else {
+			std::cout << "Checkpoint " << path_ << " belongs to a different frame, starting over" << std::endl;
+		}
+	}
+	existing.close();
+
+	if (valid_size > 0) {
+		if (!truncateFile(path_, valid_size)) {
+			std::cout << "Error truncating checkpoint " << path_ << std::endl;
+			return false;
+		}
+		log_.open(path_, std::ios::binary | std::ios::app);
+	}
+	else {
+		log_.open(path_, std::ios::binary | std::ios::trunc);
+		log_.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		log_.flush();
+	}
+	last_flush_ = std::chrono::steady_clock::now();
+
+	if (!log_) {
+		std::cout << "Error opening checkpoint " << path_ << std::endl;
+		return false;
+	}
+	return true;
+}
+
+std::streamoff CheckpointSink::replay(std::ifstream & file)
+{
+	std::streamoff valid_size = file.tellg();
+	RgbImage tile{ format_ };
+	TileRecord rec;
+	while (file.read(reinterpret_cast<char*>(&rec), sizeof(rec))) {
+		if (rec.magic != TILE_MAGIC || rec.width <= 0 || rec.height <= 0)
+			break;
+		if (tile.width() != rec.width || tile.height() != rec.height)
+			tile.resize(rec.width, rec.height);
+		if (rec.bytes != tile.scanlineBytes() * rec.height)
+			break;
+
+		uint32_t crc = Util::crc32(reinterpret_cast<const uint8_t*>(&rec), sizeof(rec));
+		int row = 0;
+		for (; row < rec.height; row++) {
+			if (!file.read(reinterpret_cast<char*>(tile.scanline(row)), tile.scanlineBytes()))
+				break;
+			crc = Util::crc32(tile.scanline(row), tile.scanlineBytes(), crc);
+		}
+		uint32_t stored_crc;
+		if (row != rec.height || !file.read(reinterpret_cast<char*>(&stored_crc), sizeof(stored_crc)) || stored_crc != crc)
+			break;
+
+		target_->writeTile(rec.x, rec.y, tile);
+		done_.insert(std::make_pair(rec.x, rec.y));
+		valid_size = file.tellg();
+	}
+	return valid_size;
+}
+
+void CheckpointSink::writeTile(int x, int y, const RgbImage & tile)
+{
+	target_->writeTile(x, y, tile);
+
+	TileRecord rec;
+	rec.magic = TILE_MAGIC;
+	rec.x = x;
+	rec.y = y;
+	rec.width = tile.width();
+	rec.height = tile.height();
+	rec.bytes = static_cast<uint32_t>(tile.scanlineBytes() * tile.height());
+
+	uint32_t crc = Util::crc32(reinterpret_cast<const uint8_t*>(&rec), sizeof(rec));
+	for (int row = 0; row < tile.height(); row++)
+		crc = Util::crc32(tile.scanline(row), tile.scanlineBytes(), crc);
+
+	std::lock_guard<std::mutex> lock(log_mutex_);
+	log_.write(reinterpret_cast<const char*>(&rec), sizeof(rec));
+	for (int row = 0; row < tile.height(); row++)
+		log_.write(reinterpret_cast<const char*>(tile.scanline(row)), tile.scanlineBytes());
+	log_.write(reinterpret_cast<const char*>(&crc), sizeof(crc));
+
+	auto now = std::chrono::steady_clock::now();
+	if (std::chrono::duration<double>(now - last_flush_).count() >= flush_interval_) {
+		log_.flush();
+		last_flush_ = now;
+	}
+}
+
+bool CheckpointSink::end()
+{
+	log_.close();
+	bool ok = !log_.fail();
+	return target_->end() && ok;
+}
+
+bool CheckpointSink::hasTile(int x, int y) const
+{
+	return done_.count(std::make_pair(x, y)) > 0;
+}
+
+int CheckpointSink::restoredTiles() const
+{
+	return static_cast<int>(done_.size());
+}
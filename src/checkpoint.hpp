@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <chrono>
+#include "tilesink.hpp"
+
+/// @brief Appends every finished tile to a log file before passing it on to another sink.
+/// When a render of the same frame is restarted with the same log, the logged tiles are replayed into the target
+/// and the renderer skips them. A tile which was only partially written when the process died is discarded.
+class CheckpointSink : public TileSink
+{
+public:
+	// The log is flushed to disk at most every flush_interval seconds and at the end of the render
+	CheckpointSink(const std::string& path, TileSink* target, double flush_interval = 10);
+
+	virtual bool begin(int width, int height, int tile_width, int tile_height, uint64_t frame_key);
+	virtual void writeTile(int x, int y, const RgbImage& tile);
+	virtual bool end();
+	virtual bool hasTile(int x, int y) const;
+
+	// Number of tiles restored from the log by begin()
+	int restoredTiles() const;
+
+private:
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		int32_t width, height;
+		int32_t tile_width, tile_height;
+		int32_t format;
+		uint64_t frame_key;
+	};
+
+	struct TileRecord {
+		uint32_t magic;
+		int32_t x, y;
+		int32_t width, height;
+		uint32_t bytes; // followed by the pixel data and a CRC-32 of record and pixel data
+	};
+
+	// Replay the records of an existing log with a matching header, returns the size of the valid part of the file
+	std::streamoff replay(std::ifstream& file);
+
+	std::string path_;
+	TileSink* target_;
+	double flush_interval_;
+
+	std::ofstream log_;
+	std::mutex log_mutex_;
+	std::chrono::steady_clock::time_point last_flush_;
+
+	std::set<std::pair<int, int>> done_;
+};
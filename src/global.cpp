@@ -3,6 +3,7 @@
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <array>
 
 using namespace Util;
 
@@ -25,4 +26,44 @@ double Util::radToDeg(double rad)
 	return rad * 180 / M_PI;
 }
 
+static std::array<uint32_t, 256> makeCrcTable()
+{
+	std::array<uint32_t, 256> table;
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+		table[n] = c;
+	}
+	return table;
+}
+
+uint32_t Util::crc32(const uint8_t * data, size_t length, uint32_t crc)
+{
+	static const std::array<uint32_t, 256> table = makeCrcTable();
+
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++)
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
 
+uint32_t Util::adler32(const uint8_t * data, size_t length, uint32_t adler)
+{
+	uint32_t a = adler & 0xffff, b = adler >> 16;
+	for (size_t i = 0; i < length; i++) {
+		a = (a + data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+uint64_t Util::hash64(const void * data, size_t length, uint64_t hash)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < length; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
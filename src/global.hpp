@@ -1,6 +1,8 @@
 #pragma once
 
 #include <Eigen/Geometry>
+#include <cstdint>
+#include <cstddef>
 
 using Vec2 = Eigen::Vector2d;
 using Vec3 = Eigen::Vector3d;
@@ -9,6 +11,9 @@ using Mat33 = Eigen::Matrix3d;
 using SE3 = Eigen::Projective3d;
 using Mat = Eigen::MatrixXd;
 using RGBd = Eigen::Array3d;
+using ArrayX3 = Eigen::Array<double, Eigen::Dynamic, 3>;
+using AABB3 = Eigen::AlignedBox3d;
+using AABB2 = Eigen::AlignedBox2d;
 
 #define SCREEN_WIDTH 1600
 #define SCREEN_HEIGHT 1200
@@ -25,4 +30,26 @@ namespace Util{
 	double degToRad(double deg);
 	
 	double radToDeg(double rad);
+
+	// CRC-32 as used by PNG and zlib, pass the previous result to continue a checksum
+	uint32_t crc32(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+	// Adler-32 checksum of zlib streams
+	uint32_t adler32(const uint8_t* data, size_t length, uint32_t adler = 1);
+
+	// 64 bit FNV-1a hash, pass the previous result to hash several blocks
+	uint64_t hash64(const void* data, size_t length, uint64_t hash = 14695981039346656037ull);
+
+	// Integer power by repeated squaring, much cheaper than std::pow for small exponents
+	inline double powInt(double base, int exp)
+	{
+		double result = 1;
+		while (exp > 0) {
+			if (exp & 1)
+				result *= base;
+			base *= base;
+			exp >>= 1;
+		}
+		return result;
+	}
 }
\ No newline at end of file
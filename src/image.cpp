@@ -0,0 +1,176 @@
+#include "image.hpp"
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+RgbImage::RgbImage(PixelFormat format) :
+	width_{ 0 }, height_{ 0 }, format_{ format }
+{
+}
+
+RgbImage::RgbImage(int width, int height, PixelFormat format) :
+	width_{ 0 }, height_{ 0 }, format_{ format }
+{
+	resize(width, height);
+}
+
+int RgbImage::width() const
+{
+	return width_;
+}
+
+int RgbImage::height() const
+{
+	return height_;
+}
+
+PixelFormat RgbImage::format() const
+{
+	return format_;
+}
+
+void RgbImage::setFormat(PixelFormat format)
+{
+	format_ = format;
+	resize(width_, height_);
+}
+
+void RgbImage::resize(int width, int height)
+{
+	width_ = width;
+	height_ = height;
+	data_.assign(static_cast<size_t>(width_) * height_ * bytesPerPixel(format_), 0);
+}
+
+void RgbImage::setPixel(int x, int y, const RGBd & color)
+{
+	uint8_t* p = pixelData(x, y);
+	switch (format_) {
+	case PixelFormat::Rgb8:
+		for (int c = 0; c < 3; c++)
+			p[c] = static_cast<uint8_t>(std::lround(std::min(std::max(color[c], 0.0), 1.0) * 255));
+		break;
+	case PixelFormat::Rgb16: {
+		uint16_t v[3];
+		for (int c = 0; c < 3; c++)
+			v[c] = static_cast<uint16_t>(std::lround(std::min(std::max(color[c], 0.0), 1.0) * 65535));
+		std::memcpy(p, v, sizeof(v));
+		break;
+	}
+	case PixelFormat::Float32: {
+		float v[3] = { static_cast<float>(color[0]), static_cast<float>(color[1]), static_cast<float>(color[2]) };
+		std::memcpy(p, v, sizeof(v));
+		break;
+	}
+	}
+}
+
+RGBd RgbImage::pixel(int x, int y) const
+{
+	const uint8_t* p = pixelData(x, y);
+	RGBd color;
+	switch (format_) {
+	case PixelFormat::Rgb8:
+		for (int c = 0; c < 3; c++)
+			color[c] = p[c] / 255.0;
+		break;
+	case PixelFormat::Rgb16: {
+		uint16_t v[3];
+		std::memcpy(v, p, sizeof(v));
+		for (int c = 0; c < 3; c++)
+			color[c] = v[c] / 65535.0;
+		break;
+	}
+	case PixelFormat::Float32: {
+		float v[3];
+		std::memcpy(v, p, sizeof(v));
+		for (int c = 0; c < 3; c++)
+			color[c] = v[c];
+		break;
+	}
+	}
+	return color;
+}
+
+void RgbImage::copyFrom(const RgbImage & src, int x, int y)
+{
+	assert(x >= 0 && x + src.width() <= width_);
+	assert(y >= 0 && y + src.height() <= height_);
+	for (int row = 0; row < src.height(); row++) {
+		if (src.format() == format_) {
+			std::memcpy(pixelData(x, y + row), src.scanline(row), src.scanlineBytes());
+		}
+		else {
+			for (int col = 0; col < src.width(); col++)
+				setPixel(x + col, y + row, src.pixel(col, row));
+		}
+	}
+}
+
+void RgbImage::copyRegionFrom(const RgbImage & src, int x, int y)
+{
+	assert(x >= 0 && x + width_ <= src.width());
+	assert(y >= 0 && y + height_ <= src.height());
+	for (int row = 0; row < height_; row++) {
+		if (src.format() == format_) {
+			std::memcpy(scanline(row), src.pixelData(x, y + row), scanlineBytes());
+		}
+		else {
+			for (int col = 0; col < width_; col++)
+				setPixel(col, row, src.pixel(x + col, y + row));
+		}
+	}
+}
+
+uint8_t * RgbImage::scanline(int y)
+{
+	return pixelData(0, y);
+}
+
+const uint8_t * RgbImage::scanline(int y) const
+{
+	return pixelData(0, y);
+}
+
+size_t RgbImage::scanlineBytes() const
+{
+	return static_cast<size_t>(width_) * bytesPerPixel(format_);
+}
+
+size_t RgbImage::bytesPerPixel(PixelFormat format)
+{
+	switch (format) {
+	case PixelFormat::Rgb16:
+		return 3 * sizeof(uint16_t);
+	case PixelFormat::Float32:
+		return 3 * sizeof(float);
+	default:
+		return 3;
+	}
+}
+
+#ifdef RAYTRACER_WITH_OPENCV
+cv::Mat RgbImage::toCv() const
+{
+	cv::Mat bgr(height_, width_, CV_8UC3);
+	for (int y = 0; y < height_; y++) {
+		for (int x = 0; x < width_; x++) {
+			RGBd color = pixel(x, y);
+			for (int c = 0; c < 3; c++)
+				bgr.at<cv::Vec3b>(y, x)[2 - c] = static_cast<uint8_t>(std::lround(std::min(std::max(color[c], 0.0), 1.0) * 255));
+		}
+	}
+	return bgr;
+}
+#endif
+
+uint8_t * RgbImage::pixelData(int x, int y)
+{
+	return data_.data() + (static_cast<size_t>(y) * width_ + x) * bytesPerPixel(format_);
+}
+
+const uint8_t * RgbImage::pixelData(int x, int y) const
+{
+	return data_.data() + (static_cast<size_t>(y) * width_ + x) * bytesPerPixel(format_);
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "global.hpp"
+
+#ifdef RAYTRACER_WITH_OPENCV
+#include <opencv2/core.hpp>
+#endif
+
+/// @brief Storage format of the pixels of an RgbImage
+enum class PixelFormat {
+	Rgb8,	// 8 bit per channel, the values are written to files unchanged and displayed as sRGB
+	Rgb16,	// 16 bit per channel
+	Float32	// 32 bit float per channel, no quantization
+};
+
+class RgbImage
+{
+public:
+	RgbImage(PixelFormat format = PixelFormat::Rgb8);
+	RgbImage(int width, int height, PixelFormat format = PixelFormat::Rgb8);
+
+	int width() const;
+	int height() const;
+
+	PixelFormat format() const;
+
+	// Changing the format or the size discards the pixels
+	void setFormat(PixelFormat format);
+	void resize(int width, int height);
+
+	// Store a color, channels are clamped to [0,1] for the integer formats
+	void setPixel(int x, int y, const RGBd& color);
+	RGBd pixel(int x, int y) const;
+
+	// Copy another image into this one with its top-left corner at (x,y)
+	void copyFrom(const RgbImage& src, int x, int y);
+
+	// Fill this image with the region of src starting at pixel (x,y)
+	void copyRegionFrom(const RgbImage& src, int x, int y);
+
+	// Raw pixel data of one row, interleaved r,g,b channels in the native byte order
+	uint8_t* scanline(int y);
+	const uint8_t* scanline(int y) const;
+	size_t scanlineBytes() const;
+
+	static size_t bytesPerPixel(PixelFormat format);
+
+#ifdef RAYTRACER_WITH_OPENCV
+	// 8 bit BGR copy for displaying the image
+	cv::Mat toCv() const;
+#endif
+
+private:
+	uint8_t* pixelData(int x, int y);
+	const uint8_t* pixelData(int x, int y) const;
+
+	int width_;
+	int height_;
+	PixelFormat format_;
+	std::vector<uint8_t> data_;
+};
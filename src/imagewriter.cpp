@@ -0,0 +1,297 @@
+#include "imagewriter.hpp"
+#include <iostream>
+#include <memory>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <cctype>
+
+#ifdef RAYTRACER_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+ImageWriter::~ImageWriter()
+{
+}
+
+ImageWriter * ImageWriter::create(const std::string & path)
+{
+	std::string extension = path.substr(std::min(path.size(), path.rfind('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension == ".ppm")
+		return new PpmWriter;
+	if (extension == ".pfm")
+		return new PfmWriter;
+	if (extension == ".png")
+		return new PngWriter;
+	return nullptr;
+}
+
+void ImageWriter::toBigEndian16(const uint8_t * data, std::vector<uint8_t>* out) const
+{
+	out->resize(width_ * 3 * 2);
+	for (int i = 0; i < width_ * 3; i++) {
+		uint16_t v;
+		if (format_ == PixelFormat::Float32) {
+			float f;
+			std::memcpy(&f, data + i * sizeof(float), sizeof(float));
+			v = static_cast<uint16_t>(std::lround(std::min(std::max(f, 0.0f), 1.0f) * 65535));
+		}
+		else if (format_ == PixelFormat::Rgb16) {
+			std::memcpy(&v, data + i * sizeof(uint16_t), sizeof(uint16_t));
+		}
+		else {
+			v = data[i] * 257;
+		}
+		(*out)[2 * i] = static_cast<uint8_t>(v >> 8);
+		(*out)[2 * i + 1] = static_cast<uint8_t>(v & 0xff);
+	}
+}
+
+void ImageWriter::toFloat(const uint8_t * data, std::vector<float>* out) const
+{
+	out->resize(width_ * 3);
+	for (int i = 0; i < width_ * 3; i++) {
+		if (format_ == PixelFormat::Float32) {
+			std::memcpy(&(*out)[i], data + i * sizeof(float), sizeof(float));
+		}
+		else if (format_ == PixelFormat::Rgb16) {
+			uint16_t v;
+			std::memcpy(&v, data + i * sizeof(uint16_t), sizeof(uint16_t));
+			(*out)[i] = v / 65535.0f;
+		}
+		else {
+			(*out)[i] = data[i] / 255.0f;
+		}
+	}
+}
+
+
+bool PpmWriter::begin(const std::string & path, int width, int height, PixelFormat format)
+{
+	width_ = width;
+	height_ = height;
+	format_ = format;
+	file_.open(path, std::ios::binary);
+	if (!file_) {
+		std::cout << "Error opening " << path << " for writing" << std::endl;
+		return false;
+	}
+	file_ << "P6\n" << width << " " << height << "\n" << (format == PixelFormat::Rgb8 ? 255 : 65535) << "\n";
+	return bool(file_);
+}
+
+bool PpmWriter::writeScanline(const uint8_t * data)
+{
+	if (format_ == PixelFormat::Rgb8) {
+		file_.write(reinterpret_cast<const char*>(data), width_ * 3);
+	}
+	else {
+		toBigEndian16(data, &buffer_);
+		file_.write(reinterpret_cast<const char*>(buffer_.data()), buffer_.size());
+	}
+	return bool(file_);
+}
+
+bool PpmWriter::end()
+{
+	file_.close();
+	return !file_.fail();
+}
+
+
+bool PfmWriter::begin(const std::string & path, int width, int height, PixelFormat format)
+{
+	width_ = width;
+	height_ = height;
+	format_ = format;
+	row_ = 0;
+	file_.open(path, std::ios::binary);
+	if (!file_) {
+		std::cout << "Error opening " << path << " for writing" << std::endl;
+		return false;
+	}
+
+	// A negative scale marks little endian data
+	uint16_t probe = 1;
+	bool little_endian = *reinterpret_cast<uint8_t*>(&probe) == 1;
+	file_ << "PF\n" << width << " " << height << "\n" << (little_endian ? "-1.0" : "1.0") << "\n";
+	data_offset_ = file_.tellp();
+	return bool(file_);
+}
+
+bool PfmWriter::writeScanline(const uint8_t * data)
+{
+	toFloat(data, &buffer_);
+	std::streamoff row_bytes = static_cast<std::streamoff>(width_) * 3 * sizeof(float);
+	file_.seekp(data_offset_ + (height_ - 1 - row_) * row_bytes);
+	file_.write(reinterpret_cast<const char*>(buffer_.data()), row_bytes);
+	row_++;
+	return bool(file_);
+}
+
+bool PfmWriter::end()
+{
+	file_.close();
+	return !file_.fail();
+}
+
+
+// Size of the IDAT chunks
+const size_t PNG_CHUNK_SIZE = 1 << 16;
+
+PngWriter::PngWriter() :
+	adler_{ 1 }, stream_started_{ false }, zstream_{ nullptr }
+{
+}
+
+PngWriter::~PngWriter()
+{
+#ifdef RAYTRACER_WITH_ZLIB
+	if (zstream_ != nullptr) {
+		deflateEnd(static_cast<z_stream*>(zstream_));
+		delete static_cast<z_stream*>(zstream_);
+	}
+#endif
+}
+
+static void appendBigEndian32(std::vector<uint8_t>* out, uint32_t v)
+{
+	out->push_back(static_cast<uint8_t>(v >> 24));
+	out->push_back(static_cast<uint8_t>(v >> 16));
+	out->push_back(static_cast<uint8_t>(v >> 8));
+	out->push_back(static_cast<uint8_t>(v));
+}
+
+bool PngWriter::begin(const std::string & path, int width, int height, PixelFormat format)
+{
+	width_ = width;
+	height_ = height;
+	format_ = format;
+	file_.open(path, std::ios::binary);
+	if (!file_) {
+		std::cout << "Error opening " << path << " for writing" << std::endl;
+		return false;
+	}
+
+	const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	file_.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	std::vector<uint8_t> header;
+	appendBigEndian32(&header, width);
+	appendBigEndian32(&header, height);
+	header.push_back(format == PixelFormat::Rgb8 ? 8 : 16); // bit depth
+	header.push_back(2); // color type RGB
+	header.push_back(0); // compression
+	header.push_back(0); // filter
+	header.push_back(0); // no interlacing
+	writeChunk("IHDR", header.data(), header.size());
+
+#ifdef RAYTRACER_WITH_ZLIB
+	z_stream* zs = new z_stream;
+	std::memset(zs, 0, sizeof(z_stream));
+	if (deflateInit(zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		std::cout << "Error initialising zlib for " << path << std::endl;
+		delete zs;
+		return false;
+	}
+	zstream_ = zs;
+#endif
+	return bool(file_);
+}
+
+bool PngWriter::writeScanline(const uint8_t * data)
+{
+	// Every row starts with its filter type, 0 = none
+	row_.assign(1, 0);
+	if (format_ == PixelFormat::Rgb8) {
+		row_.insert(row_.end(), data, data + width_ * 3);
+	}
+	else {
+		std::vector<uint8_t> converted;
+		toBigEndian16(data, &converted);
+		row_.insert(row_.end(), converted.begin(), converted.end());
+	}
+	deflate(row_.data(), row_.size(), false);
+	return bool(file_);
+}
+
+bool PngWriter::end()
+{
+	deflate(nullptr, 0, true);
+	writeChunk("IEND", nullptr, 0);
+	file_.close();
+	return !file_.fail();
+}
+
+void PngWriter::writeChunk(const char * type, const uint8_t * data, size_t length)
+{
+	std::vector<uint8_t> buffer;
+	appendBigEndian32(&buffer, static_cast<uint32_t>(length));
+	buffer.insert(buffer.end(), type, type + 4);
+	if (length > 0)
+		buffer.insert(buffer.end(), data, data + length);
+	appendBigEndian32(&buffer, Util::crc32(buffer.data() + 4, length + 4));
+	file_.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+}
+
+void PngWriter::deflate(const uint8_t * data, size_t length, bool finish)
+{
+#ifdef RAYTRACER_WITH_ZLIB
+	z_stream* zs = static_cast<z_stream*>(zstream_);
+	zs->next_in = const_cast<Bytef*>(data);
+	zs->avail_in = static_cast<uInt>(length);
+	int ret;
+	do {
+		idat_.resize(PNG_CHUNK_SIZE);
+		zs->next_out = idat_.data();
+		zs->avail_out = static_cast<uInt>(idat_.size());
+		ret = ::deflate(zs, finish ? Z_FINISH : Z_NO_FLUSH);
+		size_t produced = idat_.size() - zs->avail_out;
+		if (produced > 0)
+			writeChunk("IDAT", idat_.data(), produced);
+	} while (zs->avail_out == 0 || (finish && ret != Z_STREAM_END));
+#else
+	// zlib stream of stored (uncompressed) deflate blocks
+	idat_.clear();
+	if (!stream_started_) {
+		idat_.push_back(0x78);
+		idat_.push_back(0x01);
+		stream_started_ = true;
+	}
+	adler_ = Util::adler32(data, length, adler_);
+	size_t offset = 0;
+	do {
+		size_t block = std::min<size_t>(length - offset, 0xffff);
+		bool last = finish && offset + block == length;
+		idat_.push_back(last ? 1 : 0);
+		idat_.push_back(static_cast<uint8_t>(block & 0xff));
+		idat_.push_back(static_cast<uint8_t>(block >> 8));
+		idat_.push_back(static_cast<uint8_t>(~block & 0xff));
+		idat_.push_back(static_cast<uint8_t>((~block >> 8) & 0xff));
+		if (block > 0)
+			idat_.insert(idat_.end(), data + offset, data + offset + block);
+		offset += block;
+	} while (offset < length);
+	if (finish)
+		appendBigEndian32(&idat_, adler_);
+	writeChunk("IDAT", idat_.data(), idat_.size());
+#endif
+}
+
+
+bool writeImage(const std::string & path, const RgbImage & image)
+{
+	std::unique_ptr<ImageWriter> writer{ ImageWriter::create(path) };
+	if (!writer) {
+		std::cout << "Unsupported image file extension: " << path << std::endl;
+		return false;
+	}
+	if (!writer->begin(path, image.width(), image.height(), image.format()))
+		return false;
+	for (int y = 0; y < image.height(); y++) {
+		if (!writer->writeScanline(image.scanline(y)))
+			return false;
+	}
+	return writer->end();
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <vector>
+#include "image.hpp"
+
+/// @brief Writes an image file scanline by scanline, so the whole image never has to be in memory.
+class ImageWriter
+{
+public:
+	virtual ~ImageWriter();
+
+	// Create the file and write the header. The scanlines passed later are in the given pixel format.
+	virtual bool begin(const std::string& path, int width, int height, PixelFormat format) = 0;
+
+	// Append the next scanline, rows are passed from top to bottom
+	virtual bool writeScanline(const uint8_t* data) = 0;
+
+	// Finish and close the file
+	virtual bool end() = 0;
+
+	// Writer chosen by the file extension (.ppm, .png or .pfm), nullptr for unknown extensions
+	static ImageWriter* create(const std::string& path);
+
+protected:
+	// Convert a scanline to 16 bit big endian channels
+	void toBigEndian16(const uint8_t* data, std::vector<uint8_t>* out) const;
+
+	// Convert a scanline to 32 bit float channels
+	void toFloat(const uint8_t* data, std::vector<float>* out) const;
+
+	std::ofstream file_;
+	int width_;
+	int height_;
+	PixelFormat format_;
+};
+
+/// @brief Binary PPM (P6), 8 bit for Rgb8 images and 16 bit otherwise
+class PpmWriter : public ImageWriter
+{
+public:
+	virtual bool begin(const std::string& path, int width, int height, PixelFormat format);
+	virtual bool writeScanline(const uint8_t* data);
+	virtual bool end();
+
+private:
+	std::vector<uint8_t> buffer_;
+};
+
+/// @brief Portable float map, stores the unquantized colors
+class PfmWriter : public ImageWriter
+{
+public:
+	virtual bool begin(const std::string& path, int width, int height, PixelFormat format);
+	virtual bool writeScanline(const uint8_t* data);
+	virtual bool end();
+
+private:
+	// PFM stores the rows from bottom to top, each scanline is written at its final offset
+	std::streamoff data_offset_;
+	int row_;
+	std::vector<float> buffer_;
+};
+
+/// @brief PNG, 8 bit for Rgb8 images and 16 bit otherwise.
+/// Compressed with zlib if available, otherwise the data is stored in uncompressed deflate blocks.
+class PngWriter : public ImageWriter
+{
+public:
+	PngWriter();
+	virtual ~PngWriter();
+
+	virtual bool begin(const std::string& path, int width, int height, PixelFormat format);
+	virtual bool writeScanline(const uint8_t* data);
+	virtual bool end();
+
+private:
+	void writeChunk(const char* type, const uint8_t* data, size_t length);
+
+	// Append data to the zlib stream, flushes complete IDAT chunks
+	void deflate(const uint8_t* data, size_t length, bool finish);
+
+	std::vector<uint8_t> row_;
+	std::vector<uint8_t> idat_;
+	uint32_t adler_;
+	bool stream_started_;
+	void* zstream_;
+};
+
+// Write a whole image, the format is chosen by the file extension
+bool writeImage(const std::string& path, const RgbImage& image);
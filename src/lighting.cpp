@@ -1,8 +1,17 @@
+#define _USE_MATH_DEFINES
 #include "lighting.hpp"
+#include "renderstats.hpp"
+#include <algorithm>
+#include <iterator>
+#include <cmath>
 
 Lighting::Lighting(RGBd ambient):
 	ambient_lighting_{ambient}
 {
+	shadow_mapping_.enabled_ = false;
+	shadow_mapping_.resolution_ = 0;
+	shadow_mapping_.bias_ = 0;
+	shadow_mapping_.pcf_radius_ = 0;
 }
 
 
@@ -15,10 +24,101 @@ std::vector<PointLight>& Lighting::pointLights()
 	return pointlights_;
 }
 
-RGBd Lighting::computeColor(const Intersection & is, const Vec3& cam_pos, const SceneObjects& objects, int depth)
+uint64_t Lighting::hash(uint64_t seed) const
+{
+	seed = Util::hash64(ambient_lighting_.data(), sizeof(double) * 3, seed);
+	for (auto pl = pointlights_.begin(); pl != pointlights_.end(); pl++) {
+		double values[11] = {
+			pl->pos()[0], pl->pos()[1], pl->pos()[2],
+			pl->colorDiffuse()[0], pl->colorDiffuse()[1], pl->colorDiffuse()[2], pl->intensityDiffuse(),
+			pl->colorSpecular()[0], pl->colorSpecular()[1], pl->colorSpecular()[2], pl->intensitySpecular()
+		};
+		seed = Util::hash64(values, sizeof(values), seed);
+	}
+	if (shadow_mapping_.enabled_) {
+		seed = Util::hash64(&shadow_mapping_.resolution_, sizeof(int), seed);
+		seed = Util::hash64(&shadow_mapping_.bias_, sizeof(double), seed);
+		seed = Util::hash64(&shadow_mapping_.pcf_radius_, sizeof(int), seed);
+	}
+	return seed;
+}
+
+void Lighting::prepare(const Scene & scene, int threads)
+{
+	shadow_mapping_.maps_.clear();
+	if (!shadow_mapping_.enabled_)
+		return;
+
+	for (auto pl = pointlights_.begin(); pl != pointlights_.end(); pl++) {
+		shadow_mapping_.maps_.push_back(ShadowCubeMap{ shadow_mapping_.resolution_ });
+		shadow_mapping_.maps_.back().build(pl->pos(), scene, threads);
+	}
+}
+
+void Lighting::enableShadowMaps(int resolution, double bias, int pcf_radius)
+{
+	shadow_mapping_.enabled_ = true;
+	shadow_mapping_.resolution_ = resolution;
+	shadow_mapping_.bias_ = bias;
+	shadow_mapping_.pcf_radius_ = pcf_radius;
+}
+
+void Lighting::disableShadowMaps()
+{
+	shadow_mapping_.enabled_ = false;
+	shadow_mapping_.maps_.clear();
+}
+
+bool Lighting::shadowMapsEnabled() const
+{
+	return shadow_mapping_.enabled_;
+}
+
+double Lighting::shadowVisibility(size_t light, const Vec3 & pos, const Vec3 & dir_point2light, double light_on_normal_projection, const Scene & scene, ShadingRecord* record) const
 {
 	const double DELTA = 1e-5;
-	const Material* m = &is.obj()->material();
+
+	if (shadow_mapping_.enabled_) {
+		assert(light < shadow_mapping_.maps_.size()); // prepare() has to be called before rendering
+		return shadow_mapping_.maps_[light].visibility(pos, light_on_normal_projection, shadow_mapping_.bias_, shadow_mapping_.pcf_radius_);
+	}
+
+	RenderStats* stats = RenderStats::current();
+	if (stats)
+		stats->shadow_rays_++;
+	Ray shadowray{ pos + DELTA * dir_point2light, dir_point2light }; // move a little bit away from the surface to avoid numerical issues
+	double distance_to_light = (pointlights_[light].pos() - shadowray.pos()).norm();
+
+	SceneObject_constptr occluder = scene.anyHit(shadowray, distance_to_light);
+	if (occluder) {
+		if (record)
+			record->addOccluder(occluder);
+		return 0;
+	}
+	return 1;
+}
+
+RGBd Lighting::computeColor(const Intersection & is, const Vec3& cam_pos, const Scene& scene, int depth, ShadingRecord* record)
+{
+	// Dispatch to a kernel which only contains the terms the material needs
+	switch (scene.material(is).options()) {
+	case MaterialOption::Shiny | MaterialOption::Reflective:
+		return shade<true, true>(is, cam_pos, scene, depth, record);
+	case MaterialOption::Shiny:
+		return shade<true, false>(is, cam_pos, scene, depth, record);
+	case MaterialOption::Reflective:
+		return shade<false, true>(is, cam_pos, scene, depth, record);
+	default:
+		return shade<false, false>(is, cam_pos, scene, depth, record);
+	}
+}
+
+template<bool Shiny, bool Reflective>
+RGBd Lighting::shade(const Intersection & is, const Vec3& cam_pos, const Scene& scene, int depth, ShadingRecord* record)
+{
+	const Material* m = &scene.material(is);
+	if (record)
+		record->addPoint(is.pos());
 
 	RGBd color = Vec3::Zero(); // TODO maybe use background color?
 	
@@ -49,20 +149,12 @@ RGBd Lighting::computeColor(const Intersection & is, const Vec3& cam_pos, const
 		}
 
 		// Check if point is in shadow of this light source
-		Ray shadowray{ is.pos() + DELTA * dir_point2light, dir_point2light }; // move a little bit away from the surface to avoid numerical issues
-		
-		bool point_in_shadow = false; Intersection is_tmp{ Vec3::Zero(),Vec3::Zero(), 0, nullptr };
-		for (auto it = objects.begin(); it != objects.end(); it++) {
-			if ((*it)->intersect(shadowray, &is_tmp)) {
-				point_in_shadow = true;
-				break;
-			}
-		}
+		double visibility = shadowVisibility(pl - pointlights_.begin(), is.pos(), dir_point2light, light_on_normal_projection, scene, record);
 
-		if (!point_in_shadow)
+		if (visibility > 0)
 		{
 			// TODO calculate attenuation as a function of the distance point2light
-			double attenuation = 1;
+			double attenuation = visibility;
 
 			// calculate diffuse light component
 			double project_point2light_on_normal = dir_point2light.dot(normal);
@@ -71,46 +163,315 @@ RGBd Lighting::computeColor(const Intersection & is, const Vec3& cam_pos, const
 				color += m->diffuse_reflection() * project_point2light_on_normal * power_diffuse;
 
 				// calculate specular light component
-				RGBd power_specular = pl->colorSpecular() * pl->intensitySpecular() * attenuation;
-				Vec3 dir_reflected = 2 * normal * light_on_normal_projection - dir_point2light;
-				double project_reflected_on_point2cam = dir_reflected.dot(dir_point2cam);
-				if (project_reflected_on_point2cam > 0) {
-					RGBd spec = m->specular_reflection() * std::pow(project_reflected_on_point2cam, m->shininess()) * power_specular;
-					color += spec;
+				if (Shiny) {
+					RGBd power_specular = pl->colorSpecular() * pl->intensitySpecular() * attenuation;
+					Vec3 dir_reflected = 2 * normal * light_on_normal_projection - dir_point2light;
+					double project_reflected_on_point2cam = dir_reflected.dot(dir_point2cam);
+					if (project_reflected_on_point2cam > 0) {
+						double highlight = m->integerShininess() ?
+							Util::powInt(project_reflected_on_point2cam, m->shininessInt()) :
+							std::pow(project_reflected_on_point2cam, m->shininess());
+						RGBd spec = m->specular_reflection() * highlight * power_specular;
+						color += spec;
+					}
 				}
 			}
 		}
 	}
 
 	// Calculate reflection
-	if (m->coherent_reflection().any() && depth < 3) {
-		if (point2cam_on_normal_projection < 0) {
-			point2cam_on_normal_projection = -point2cam_on_normal_projection;
+	if (Reflective && depth < 3) {
+		color += reflectedColor(is.pos(), normal, dir_point2cam, point2cam_on_normal_projection, scene, depth, record) * m->coherent_reflection();
+	}
+
+	// Saturate color
+	color = color.max(0).min(1);
+
+	return color;
+}
+
+RGBd Lighting::reflectedColor(const Vec3 & pos, const Vec3 & normal, const Vec3 & dir_point2cam, double point2cam_on_normal_projection, const Scene & scene, int depth, ShadingRecord* record)
+{
+	const double DELTA = 1e-5;
+
+	if (point2cam_on_normal_projection < 0) {
+		point2cam_on_normal_projection = -point2cam_on_normal_projection;
+	}
+	Vec3 dir_reflected = 2 * normal * point2cam_on_normal_projection - (dir_point2cam);
+
+	Ray reflection_ray{ pos + dir_reflected*DELTA, dir_reflected };
+	RenderStats* stats = RenderStats::current();
+	if (stats)
+		stats->reflection_rays_++;
+	Hit closest;
+	bool leaves_scene = !scene.closestHit(reflection_ray, &closest);
+	if (record)
+		record->addReflection(pos, dir_reflected, leaves_scene ? nullptr : closest.obj_);
+	if (leaves_scene) {
+		return RGBd::Zero();
+	}
+	Intersection closest_is{ Vec3::Zero(), Vec3::Zero(), 0, nullptr };
+	scene.resolve(reflection_ray, closest, &closest_is);
+	return computeColor(closest_is, pos, scene, depth + 1, record);
+}
+
+// Dot product of corresponding rows
+static Eigen::ArrayXd rowwiseDot(const ArrayX3& a, const ArrayX3& b)
+{
+	return a.col(0) * b.col(0) + a.col(1) * b.col(1) + a.col(2) * b.col(2);
+}
+
+void Lighting::computeColors(const HitBatch & hits, const Vec3 & cam_pos, const Scene & scene, ArrayX3 * colors, ShadingRecord* record)
+{
+	const Eigen::Index n = hits.size();
+	const ArrayX3& pos = hits.positions();
+	if (record) {
+		for (Eigen::Index i = 0; i < n; i++)
+			record->addPoint(pos.row(i).transpose());
+	}
+
+	// Gather the material coefficients of every hit
+	ArrayX3 ambient(n, 3), diffuse(n, 3), specular(n, 3);
+	Eigen::ArrayXd shininess(n);
+	int options = 0;
+	for (Eigen::Index i = 0; i < n; i++) {
+		const Material* m = hits.materials()[hits.materialIndices()[i]];
+		ambient.row(i) = m->ambient_reflection().transpose();
+		diffuse.row(i) = m->diffuse_reflection().transpose();
+		specular.row(i) = m->specular_reflection().transpose();
+		shininess[i] = m->shininess();
+		options |= m->options();
+	}
+
+	ArrayX3 dir_point2cam(n, 3);
+	for (int c = 0; c < 3; c++)
+		dir_point2cam.col(c) = cam_pos[c] - pos.col(c);
+	dir_point2cam.colwise() /= rowwiseDot(dir_point2cam, dir_point2cam).sqrt();
+
+	// Flip normals of surfaces seen from behind
+	ArrayX3 normal = hits.normals();
+	Eigen::ArrayXd point2cam_on_normal_projection = rowwiseDot(normal, dir_point2cam);
+	normal.colwise() *= (point2cam_on_normal_projection < 0).select(-1.0, Eigen::ArrayXd::Ones(n));
+	point2cam_on_normal_projection = point2cam_on_normal_projection.max(0);
+
+	// calculate ambient light component
+	colors->resize(n, 3);
+	for (int c = 0; c < 3; c++)
+		colors->col(c) = ambient_lighting_[c] * ambient.col(c);
+
+	ArrayX3 dir_point2light(n, 3);
+	Eigen::ArrayXd visibility(n);
+	for (auto pl = pointlights_.begin(); pl != pointlights_.end(); pl++) {
+		for (int c = 0; c < 3; c++)
+			dir_point2light.col(c) = pl->pos()[c] - pos.col(c);
+		dir_point2light.colwise() /= rowwiseDot(dir_point2light, dir_point2light).sqrt();
+
+		Eigen::ArrayXd light_on_normal_projection = rowwiseDot(normal, dir_point2light);
+
+		// Shadow rays cannot be vectorized, only hits facing the light are tested
+		for (Eigen::Index i = 0; i < n; i++) {
+			visibility[i] = 0;
+			if (light_on_normal_projection[i] > 0)
+				visibility[i] = shadowVisibility(pl - pointlights_.begin(), pos.row(i).transpose(), dir_point2light.row(i).transpose(), light_on_normal_projection[i], scene, record);
 		}
-		Vec3 dir_reflected = 2 * normal * point2cam_on_normal_projection - (dir_point2cam);
-
-		Ray reflection_ray{ is.pos() + dir_reflected*DELTA, dir_reflected };
-		Intersection closest_is{ Vec3::Zero(), Vec3::Zero(), std::numeric_limits<double>().max(), nullptr };
-		for (auto obj = objects.begin(); obj != objects.end(); obj++) {
-			Intersection is_tmp{ Vec3::Zero(), Vec3::Zero(), 0, nullptr };
-			if ((*obj)->intersect(reflection_ray, &is_tmp)) {
-				if (is_tmp.distance() < closest_is.distance() && is_tmp.distance() > 0) {
-					closest_is = is_tmp;
-				}
-			}
+
+		// calculate diffuse light component
+		Eigen::ArrayXd lit = (visibility > 0).select(light_on_normal_projection * visibility, 0.0);
+		for (int c = 0; c < 3; c++)
+			colors->col(c) += diffuse.col(c) * lit * (pl->colorDiffuse()[c] * pl->intensityDiffuse());
+
+		// calculate specular light component
+		if (options & MaterialOption::Shiny) {
+			ArrayX3 dir_reflected = (2 * normal).colwise() * light_on_normal_projection - dir_point2light;
+			Eigen::ArrayXd project_reflected_on_point2cam = rowwiseDot(dir_reflected, dir_point2cam);
+			Eigen::ArrayXd highlight = (project_reflected_on_point2cam > 0 && visibility > 0).select(
+				(shininess * project_reflected_on_point2cam.log()).exp() * visibility, 0.0);
+			for (int c = 0; c < 3; c++)
+				colors->col(c) += specular.col(c) * highlight * (pl->colorSpecular()[c] * pl->intensitySpecular());
 		}
-		if (closest_is.distance() != std::numeric_limits<double>().max()) {
-			// found a intersection
-			RGBd color_reflected = computeColor(closest_is, is.pos(), objects, depth + 1);
-			color += color_reflected * m->coherent_reflection();
+	}
+
+	// Calculate reflection, the reflected rays are traced one by one
+	if (options & MaterialOption::Reflective) {
+		for (Eigen::Index i = 0; i < n; i++) {
+			const Material* m = hits.materials()[hits.materialIndices()[i]];
+			if (!(m->options() & MaterialOption::Reflective))
+				continue;
+			RGBd color_reflected = reflectedColor(pos.row(i).transpose(), normal.row(i).transpose(), dir_point2cam.row(i).transpose(), point2cam_on_normal_projection[i], scene, 0, record);
+			colors->row(i) += (color_reflected * m->coherent_reflection()).transpose();
 		}
 	}
 
 	// Saturate color
-	(color < 0).select(0, color);
-	(color > 1).select(1, color);
+	*colors = colors->max(0).min(1);
+}
 
-	return color;
+ShadingRecord::ShadingRecord()
+{
+	clear();
+}
+
+void ShadingRecord::clear()
+{
+	objects_.clear();
+	points_.setEmpty();
+	reflection_origins_.setEmpty();
+	reflection_dirs_.clear();
+	reflection_axis_ = Vec3::UnitZ();
+	reflection_angle_ = -1;
+}
+
+void ShadingRecord::addPoint(const Vec3 & pos)
+{
+	points_.extend(pos);
+}
+
+void ShadingRecord::addOccluder(SceneObject_constptr obj)
+{
+	objects_.push_back(obj);
+}
+
+void ShadingRecord::addReflection(const Vec3 & origin, const Vec3 & dir, SceneObject_constptr hit)
+{
+	reflection_origins_.extend(origin);
+	reflection_dirs_.push_back(dir.normalized());
+	if (hit)
+		objects_.push_back(hit);
+}
+
+void ShadingRecord::finish()
+{
+	std::sort(objects_.begin(), objects_.end());
+	objects_.erase(std::unique(objects_.begin(), objects_.end()), objects_.end());
+
+	if (reflection_dirs_.empty())
+		return;
+	Vec3 sum = Vec3::Zero();
+	for (auto d = reflection_dirs_.begin(); d != reflection_dirs_.end(); d++)
+		sum += *d;
+	if (sum.norm() < 1e-6) {
+		// Directions cancel out, the cone has to contain every direction
+		reflection_angle_ = M_PI;
+	}
+	else {
+		reflection_axis_ = sum.normalized();
+		double min_cos = 1;
+		for (auto d = reflection_dirs_.begin(); d != reflection_dirs_.end(); d++)
+			min_cos = std::min(min_cos, reflection_axis_.dot(*d));
+		reflection_angle_ = std::max(reflection_angle_, std::acos(std::max(-1.0, min_cos)));
+	}
+	reflection_dirs_.clear();
+}
+
+void ShadingRecord::merge(const ShadingRecord & other)
+{
+	std::vector<SceneObject_constptr> objects;
+	std::set_union(objects_.begin(), objects_.end(), other.objects_.begin(), other.objects_.end(), std::back_inserter(objects));
+	objects_.swap(objects);
+	points_.extend(other.points_);
+	reflection_origins_.extend(other.reflection_origins_);
+
+	if (other.reflection_angle_ < 0)
+		return;
+	if (reflection_angle_ < 0) {
+		reflection_axis_ = other.reflection_axis_;
+		reflection_angle_ = other.reflection_angle_;
+		return;
+	}
+	// Cone around the mean axis containing both cones
+	Vec3 sum = reflection_axis_ + other.reflection_axis_;
+	if (sum.norm() < 1e-6) {
+		reflection_angle_ = M_PI;
+		return;
+	}
+	Vec3 axis = sum.normalized();
+	double angle = std::max(
+		std::acos(std::min(1.0, axis.dot(reflection_axis_))) + reflection_angle_,
+		std::acos(std::min(1.0, axis.dot(other.reflection_axis_))) + other.reflection_angle_);
+	reflection_axis_ = axis;
+	reflection_angle_ = std::min(angle, M_PI);
+}
+
+bool ShadingRecord::dependsOn(SceneObject_constptr obj) const
+{
+	return std::binary_search(objects_.begin(), objects_.end(), obj);
+}
+
+bool ShadingRecord::mayBeAffectedBy(const AABB3 & bounds, const std::vector<PointLight>& lights) const
+{
+	// Shadow rays run from the points to the lights, they stay inside the box around the points and the light
+	if (!points_.isEmpty()) {
+		for (auto pl = lights.begin(); pl != lights.end(); pl++) {
+			AABB3 shadow_rays = points_;
+			shadow_rays.extend(pl->pos());
+			if (shadow_rays.intersects(bounds))
+				return true;
+		}
+	}
+
+	// A ray starting inside a sphere of radius r_o hits a sphere of radius r if a ray from the center
+	// of the first one hits a sphere of radius r + r_o, so the reflection cone is tested against that sphere
+	if (reflection_angle_ < 0)
+		return false;
+	Vec3 to_object = bounds.center() - reflection_origins_.center();
+	double radius = (bounds.diagonal().norm() + reflection_origins_.diagonal().norm()) / 2;
+	double distance = to_object.norm();
+	if (distance <= radius)
+		return true;
+	double angle_to_object = std::acos(std::max(-1.0, std::min(1.0, reflection_axis_.dot(to_object) / distance)));
+	return angle_to_object <= reflection_angle_ + std::asin(radius / distance);
+}
+
+void HitBatch::assign(const ArenaVector<Intersection>& hits, const Scene& scene)
+{
+	Eigen::Index n = hits.size();
+	pos_.resize(n, 3);
+	normal_.resize(n, 3);
+	material_index_.resize(n);
+	materials_.clear();
+	for (auto m = scene.materials().begin(); m != scene.materials().end(); m++)
+		materials_.push_back(&*m);
+
+	for (Eigen::Index i = 0; i < n; i++) {
+		pos_.row(i) = hits[i].pos().transpose();
+		normal_.row(i) = hits[i].normal().transpose();
+		if (hits[i].materialId() >= 0) {
+			material_index_[i] = hits[i].materialId();
+			continue;
+		}
+
+		// Hits not found through the scene, only a handful of materials are visible in a tile, a linear search is fine
+		const Material* m = &hits[i].obj()->material();
+		auto it = std::find(materials_.begin(), materials_.end(), m);
+		material_index_[i] = static_cast<int>(it - materials_.begin());
+		if (it == materials_.end())
+			materials_.push_back(m);
+	}
+}
+
+int HitBatch::size() const
+{
+	return static_cast<int>(pos_.rows());
+}
+
+const ArrayX3 & HitBatch::positions() const
+{
+	return pos_;
+}
+
+const ArrayX3 & HitBatch::normals() const
+{
+	return normal_;
+}
+
+const Eigen::ArrayXi & HitBatch::materialIndices() const
+{
+	return material_index_;
+}
+
+const std::vector<const Material*>& HitBatch::materials() const
+{
+	return materials_;
 }
 
 PointLight::PointLight(Vec3 pos, RGBd col_diffuse, double i_diffuse, RGBd col_spec, double i_spec) :
@@ -1,6 +1,8 @@
 #pragma once
 #include "global.hpp"
 #include "sceneobject.hpp"
+#include "scene.hpp"
+#include "shadowmap.hpp"
 #include <vector>
 
 class PointLight
@@ -35,18 +37,114 @@ private:
 };
 
 
+/// @brief What the shading of a group of pixels depended on, used to find the pixels a change of the scene can affect.
+/// Holds the objects hit by shadow and reflection rays, the bounds of all shaded points and a cone containing all reflection rays.
+class ShadingRecord
+{
+public:
+	ShadingRecord();
+
+	void clear();
+
+	void addPoint(const Vec3& pos);
+	void addOccluder(SceneObject_constptr obj);
+	// hit is nullptr if the ray left the scene
+	void addReflection(const Vec3& origin, const Vec3& dir, SceneObject_constptr hit);
+
+	// Call after adding everything, sorts the objects and computes the reflection cone
+	void finish();
+
+	// Union of both records, the result is conservative
+	void merge(const ShadingRecord& other);
+
+	// Whether a shadow or reflection ray hit the object
+	bool dependsOn(SceneObject_constptr obj) const;
+
+	// Whether an object inside bounds could block a shadow ray or be hit by a reflection ray of the recorded points
+	bool mayBeAffectedBy(const AABB3& bounds, const std::vector<PointLight>& lights) const;
+
+private:
+	std::vector<SceneObject_constptr> objects_;
+	AABB3 points_;
+
+	AABB3 reflection_origins_;
+	std::vector<Vec3> reflection_dirs_; // only until finish()
+	Vec3 reflection_axis_;
+	double reflection_angle_; // half opening angle of the cone, < 0 if there were no reflection rays
+};
+
+
+/// @brief Structure of arrays holding the hits of an image tile, so that shading can be vectorized over many hits
+class HitBatch
+{
+public:
+	// Materials are taken from the table of the scene
+	void assign(const ArenaVector<Intersection>& hits, const Scene& scene);
+
+	int size() const;
+
+	const ArrayX3& positions() const;
+	const ArrayX3& normals() const;
+
+	// Index into materials() for each hit
+	const Eigen::ArrayXi& materialIndices() const;
+	const std::vector<const Material*>& materials() const;
+
+private:
+	ArrayX3 pos_;
+	ArrayX3 normal_;
+	Eigen::ArrayXi material_index_;
+	std::vector<const Material*> materials_;
+};
+
+
 class Lighting
 {
 public:
 	Lighting(RGBd ambient_light);
 	virtual ~Lighting();
 
-	virtual RGBd computeColor(const Intersection & is, const Vec3& cam_pos, const SceneObjects& objects, int depth=0);
+	// If record is given, everything the color depends on is added to it
+	virtual RGBd computeColor(const Intersection & is, const Vec3& cam_pos, const Scene& scene, int depth=0, ShadingRecord* record=nullptr);
+
+	// Shade a whole batch of hits at once, same result as computeColor for each hit. colors has one row per hit.
+	void computeColors(const HitBatch& hits, const Vec3& cam_pos, const Scene& scene, ArrayX3* colors, ShadingRecord* record=nullptr);
+
+	// Called once per frame before rendering, builds the shadow maps if they are enabled
+	void prepare(const Scene& scene, int threads);
+
+	// Approximate shadows by a depth cube map per light instead of tracing a shadow ray per light and hit.
+	// bias is in world units, pcf_radius = 0 disables filtering.
+	void enableShadowMaps(int resolution, double bias, int pcf_radius);
+	void disableShadowMaps();
+	bool shadowMapsEnabled() const;
 
 	std::vector<PointLight>& pointLights();
+
+	// Hash of all light sources and shadow settings
+	uint64_t hash(uint64_t seed) const;
 private:
+	// Phong shading kernel, terms the material does not need are compiled out
+	template<bool Shiny, bool Reflective>
+	RGBd shade(const Intersection & is, const Vec3& cam_pos, const Scene& scene, int depth, ShadingRecord* record);
+
+	// Color seen in the mirror direction of the view ray
+	RGBd reflectedColor(const Vec3& pos, const Vec3& normal, const Vec3& dir_point2cam, double point2cam_on_normal_projection, const Scene& scene, int depth, ShadingRecord* record);
+
+	// Fraction of light arriving at a point, 0 = in shadow. Only objects between the point and the light cast shadows.
+	double shadowVisibility(size_t light, const Vec3& pos, const Vec3& dir_point2light, double light_on_normal_projection, const Scene& scene, ShadingRecord* record) const;
+
 	RGBd ambient_lighting_;
 	std::vector<PointLight> pointlights_;
 
+	struct ShadowMapping {
+		bool enabled_;
+		int resolution_;
+		double bias_;
+		int pcf_radius_;
+		std::vector<ShadowCubeMap> maps_;
+	};
+	ShadowMapping shadow_mapping_;
+
 };
 
@@ -2,17 +2,169 @@
 #include <iostream>
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
-#include <opencv2/opencv.hpp>
+#ifdef RAYTRACER_WITH_OPENCV
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
+#endif
+
+#include <string>
+#include <cstdio>
+#include <memory>
+#include <utility>
 
 #include "raytracer.hpp"
 #include "trimesh.hpp"
+#include "meshcache.hpp"
+#include "imagewriter.hpp"
+#include "checkpoint.hpp"
+
+struct Options {
+	int width = SCREEN_WIDTH;
+	int height = SCREEN_HEIGHT;
+	double focal_length = FOCAL_LENGTH;
+	bool focal_length_set = false;
+	double scale = 1;
+	bool crop = false;
+	int crop_x = 0, crop_y = 0, crop_width = 0, crop_height = 0;
+	int threads = 8;
+	std::string output = "render.png";
+	PixelFormat format = PixelFormat::Rgb8;
+	std::string tile_dir;
+	std::string checkpoint;
+	std::string stats;
+	int shadow_map_resolution = 0;
+	bool visibility_buffer = false;
+	std::string mesh_cache;
+	bool reorder_meshes = false;
+	int mesh_lods = 0;
+	bool window = true;
+};
+
+void printUsage(const char* program)
+{
+	std::cout << "Usage: " << program << " [options]\n"
+		"  --width W, --height H   resolution, the focal length is scaled with the width unless --focal is given\n"
+		"  --focal F               focal length in pixels\n"
+		"  --scale S               scale resolution and focal length, e.g. 0.25 for a thumbnail\n"
+		"  --crop X,Y,W,H          only render this rectangle of the frame\n"
+		"  --threads N             number of render threads (default 8)\n"
+		"  --output FILE           .png, .ppm or .pfm (default render.png)\n"
+		"  --format 8|16|float     bits per channel of the image (default 8)\n"
+		"  --tile-dir DIR          write the tiles to DIR instead of one image\n"
+		"  --checkpoint FILE       log finished tiles to FILE and resume from it\n"
+		"  --stats FILE            write rays, intersection tests and tile times of the frame to FILE as JSON\n"
+		"  --shadow-maps RES       approximate shadows with cube maps of RES x RES texels\n"
+		"  --visibility-buffer     rasterise the meshes to find the primary hits\n"
+		"  --mesh-cache DIR        keep preprocessed meshes in the existing directory DIR for faster loading\n"
+		"  --reorder-meshes        sort the faces of meshes along a space filling curve for better cache locality\n"
+		"  --mesh-lods N           build up to N simplified levels of detail per mesh, chosen by the projected size\n"
+		"  --no-window             do not display the result\n";
+}
+
+bool parseOptions(int argc, char* argv[], Options* opt)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--help") {
+			return false;
+		}
+		else if (arg == "--no-window") {
+			opt->window = false;
+			continue;
+		}
+		else if (arg == "--visibility-buffer") {
+			opt->visibility_buffer = true;
+			continue;
+		}
+		else if (arg == "--reorder-meshes") {
+			opt->reorder_meshes = true;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for " << arg << std::endl;
+			return false;
+		}
+		std::string value = argv[++i];
+		try {
+			if (arg == "--width")
+				opt->width = std::stoi(value);
+			else if (arg == "--height")
+				opt->height = std::stoi(value);
+			else if (arg == "--focal") {
+				opt->focal_length = std::stod(value);
+				opt->focal_length_set = true;
+			}
+			else if (arg == "--scale")
+				opt->scale = std::stod(value);
+			else if (arg == "--crop") {
+				opt->crop = std::sscanf(value.c_str(), "%d,%d,%d,%d", &opt->crop_x, &opt->crop_y, &opt->crop_width, &opt->crop_height) == 4;
+				if (!opt->crop) {
+					std::cout << "Invalid crop window " << value << std::endl;
+					return false;
+				}
+			}
+			else if (arg == "--threads")
+				opt->threads = std::stoi(value);
+			else if (arg == "--output")
+				opt->output = value;
+			else if (arg == "--format") {
+				if (value == "8")
+					opt->format = PixelFormat::Rgb8;
+				else if (value == "16")
+					opt->format = PixelFormat::Rgb16;
+				else if (value == "float")
+					opt->format = PixelFormat::Float32;
+				else {
+					std::cout << "Unknown format " << value << std::endl;
+					return false;
+				}
+			}
+			else if (arg == "--tile-dir")
+				opt->tile_dir = value;
+			else if (arg == "--checkpoint")
+				opt->checkpoint = value;
+			else if (arg == "--stats")
+				opt->stats = value;
+			else if (arg == "--shadow-maps")
+				opt->shadow_map_resolution = std::stoi(value);
+			else if (arg == "--mesh-cache")
+				opt->mesh_cache = value;
+			else if (arg == "--mesh-lods")
+				opt->mesh_lods = std::stoi(value);
+			else {
+				std::cout << "Unknown option " << arg << std::endl;
+				return false;
+			}
+		}
+		catch (const std::exception&) {
+			std::cout << "Invalid value for " << arg << ": " << value << std::endl;
+			return false;
+		}
+	}
+
+	// Keep the field of view when only the resolution changes
+	if (!opt->focal_length_set)
+		opt->focal_length *= static_cast<double>(opt->width) / SCREEN_WIDTH;
+	opt->width = static_cast<int>(opt->width * opt->scale);
+	opt->height = static_cast<int>(opt->height * opt->scale);
+	opt->focal_length *= opt->scale;
+	return opt->width > 0 && opt->height > 0 && opt->threads > 0 && opt->mesh_lods >= 0;
+}
 
 int main(int argc, char* argv[])
 {
+	Options opt;
+	if (!parseOptions(argc, argv, &opt)) {
+		printUsage(argv[0]);
+		return 1;
+	}
 
-	Raytracer t;
+	Raytracer t{ opt.width, opt.height, opt.focal_length };
+	if (opt.crop)
+		t.camera().setCropWindow(opt.crop_x, opt.crop_y, opt.crop_width, opt.crop_height);
+	if (opt.shadow_map_resolution > 0)
+		t.lighting().enableShadowMaps(opt.shadow_map_resolution, 0.01, 1);
+	t.setVisibilityBuffer(opt.visibility_buffer);
 
 	/// Create scene
 
@@ -32,29 +184,34 @@ int main(int argc, char* argv[])
 		Util::createSE3(0,0,0,0,0,-101), Material::Generator(MaterialColor::White, MaterialOption::Reflective | MaterialOption::Shiny), 100
 	});
 
+	// Meshes are loaded once, further instances of the same file share the geometry
+	MeshCache meshes{ opt.threads, opt.mesh_cache, opt.reorder_meshes, opt.mesh_lods };
+
 	// Stanford bunny
 	const char* bunny_path = "../models/bunny/reconstruction/bun_zipper.ply";
-	TriangularMesh::TriMesh *bunny = TriangularMesh::TriMesh::loadFromPly(bunny_path,true,
-		Util::createSE3(Util::degToRad(90), 0, Util::degToRad(235), -2.5, 0, 0).scale(15),
-		Material::Generator(MaterialColor::Green, MaterialOption::Shiny), true);
-	if (bunny == nullptr) {
+	std::shared_ptr<const TriangularMesh::MeshData> bunny = meshes.load(bunny_path, true, true);
+	if (!bunny) {
 		std::cout << "error loading " << bunny_path << std::endl;
 		std::cin.get();
 		return 0;
 	}
-	t.objects().push_back(bunny);
+	t.objects().push_back(new TriangularMesh::TriMesh{
+		Util::createSE3(Util::degToRad(90), 0, Util::degToRad(235), -2.5, 0, 0).scale(15),
+		Material::Generator(MaterialColor::Green, MaterialOption::Shiny), std::move(bunny)
+	});
 
 	// Ketchup bottle
 	const char* ketchup_path = "../models/ketchup.ply";
-	TriangularMesh::TriMesh *ketchup = TriangularMesh::TriMesh::loadFromPly(ketchup_path, false,
-		Util::createSE3(0, Util::degToRad(0), Util::degToRad(0), 2, -.5, 0.25).scale(.3),
-		Material::Generator(MaterialColor::Red, MaterialOption::Shiny ), true);
-	if (ketchup == nullptr) {
+	std::shared_ptr<const TriangularMesh::MeshData> ketchup = meshes.load(ketchup_path, false, true);
+	if (!ketchup) {
 		std::cout << "error loading " << ketchup_path << std::endl;
 		std::cin.get();
 		return 0;
 	}
-	t.objects().push_back(ketchup);
+	t.objects().push_back(new TriangularMesh::TriMesh{
+		Util::createSE3(0, Util::degToRad(0), Util::degToRad(0), 2, -.5, 0.25).scale(.3),
+		Material::Generator(MaterialColor::Red, MaterialOption::Shiny ), std::move(ketchup)
+	});
 
 	// Lights
 	t.lighting().pointLights().push_back(PointLight{
@@ -67,16 +224,39 @@ int main(int argc, char* argv[])
 	/// End of scene
 
 	// render an image of the scene
-	RgbImage img;
-	t.render(&img,8);
+	RgbImage img{ opt.format };
+	std::unique_ptr<TileSink> output;
+	if (opt.tile_dir.empty())
+		output.reset(new ImageSink{ &img });
+	else // the tiles are stored in the format of --output
+		output.reset(new TileDirectorySink{ opt.tile_dir, opt.output.substr(std::min(opt.output.size(), opt.output.rfind('.'))), opt.format });
 
-	// display the image
-	cv::namedWindow("Rendered image", cv::WINDOW_AUTOSIZE);
-	cv::imshow("Rendered image", img.cv());
-	cv::Mat3b imageF_8UC3;
-	img.cv().convertTo(imageF_8UC3, CV_8UC3, 255);
-	imwrite("render.png", imageF_8UC3);
+	TileSink* sink = output.get();
+	std::unique_ptr<CheckpointSink> checkpoint;
+	if (!opt.checkpoint.empty()) {
+		checkpoint.reset(new CheckpointSink{ opt.checkpoint, output.get() });
+		sink = checkpoint.get();
+	}
+	t.render(sink, opt.threads);
+
+	if (!opt.stats.empty() && !t.stats().writeJson(opt.stats))
+		std::cout << "Error writing " << opt.stats << std::endl;
 
-	cv::waitKey();
+	if (!opt.tile_dir.empty())
+		return 0;
+
+	if (!writeImage(opt.output, img)) {
+		std::cout << "Error writing " << opt.output << std::endl;
+		return 1;
+	}
+
+#ifdef RAYTRACER_WITH_OPENCV
+	// display the image
+	if (opt.window) {
+		cv::namedWindow("Rendered image", cv::WINDOW_AUTOSIZE);
+		cv::imshow("Rendered image", img.toCv());
+		cv::waitKey();
+	}
+#endif
 
 }
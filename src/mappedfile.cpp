@@ -0,0 +1,108 @@
+#include "mappedfile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+	data_{ nullptr }, size_{ 0 }
+#ifdef _WIN32
+	, file_{ INVALID_HANDLE_VALUE }, mapping_{ nullptr }
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char * path, Access access)
+{
+	close();
+#ifdef _WIN32
+	file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		access == Access::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file_, &size)) {
+		close();
+		return false;
+	}
+	size_ = static_cast<size_t>(size.QuadPart);
+	if (size_ == 0)
+		return true;
+	mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_ == nullptr) {
+		close();
+		return false;
+	}
+	data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+	if (data_ == nullptr) {
+		close();
+		return false;
+	}
+	return true;
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	size_ = static_cast<size_t>(st.st_size);
+	if (size_ == 0) {
+		::close(fd);
+		return true;
+	}
+	void* mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping keeps the file open
+	if (mapped == MAP_FAILED) {
+		size_ = 0;
+		return false;
+	}
+	// Sequential files are read front to back once, random ones stay mapped and are read in any order
+	madvise(mapped, size_, access == Access::Sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+	data_ = static_cast<const uint8_t*>(mapped);
+	return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (data_ != nullptr)
+		UnmapViewOfFile(data_);
+	if (mapping_ != nullptr)
+		CloseHandle(mapping_);
+	if (file_ != INVALID_HANDLE_VALUE)
+		CloseHandle(file_);
+	mapping_ = nullptr;
+	file_ = INVALID_HANDLE_VALUE;
+#else
+	if (data_ != nullptr)
+		munmap(const_cast<uint8_t*>(data_), size_);
+#endif
+	data_ = nullptr;
+	size_ = 0;
+}
+
+const uint8_t * MappedFile::data() const
+{
+	return data_;
+}
+
+size_t MappedFile::size() const
+{
+	return size_;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Read only view of a whole file mapped into memory, the pages are only read from disk when they are accessed.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// How the mapped data is read, a hint for read ahead and page eviction
+	enum class Access { Sequential, Random };
+
+	// Map the file, false if it cannot be opened or mapped
+	bool open(const char* path, Access access = Access::Sequential);
+	void close();
+
+	const uint8_t* data() const;
+	size_t size() const;
+
+private:
+	const uint8_t* data_;
+	size_t size_;
+#ifdef _WIN32
+	void* file_;
+	void* mapping_;
+#endif
+};
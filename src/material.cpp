@@ -1,4 +1,5 @@
 #include "material.hpp"
+#include <cmath>
 
 //const Material Material::DEFAULT = Material{
 //	RGBd{ 1,0,0 }, // ambient-reflection-color
@@ -23,6 +24,7 @@ Material::Material(const RGBd & ambient_reflection, const RGBd & diffuse_reflect
 	shininess_{ shininess },
 	coherent_reflection_{ coherent_reflection }
 {
+	classify();
 }
 
 RGBd & Material::ambient_reflection()
@@ -75,6 +77,43 @@ const RGBd & Material::coherent_reflection() const
 	return coherent_reflection_;
 }
 
+void Material::classify()
+{
+	options_ = 0;
+	if ((specular_reflection_ != 0).any())
+		options_ |= MaterialOption::Shiny;
+	if ((coherent_reflection_ != 0).any())
+		options_ |= MaterialOption::Reflective;
+
+	// Larger exponents are rare and std::pow is cheaper than many squarings
+	shininess_int_ = 0;
+	if (shininess_ >= 1 && shininess_ <= 256 && shininess_ == std::floor(shininess_))
+		shininess_int_ = static_cast<int>(shininess_);
+}
+
+int Material::options() const
+{
+	return options_;
+}
+
+bool Material::integerShininess() const
+{
+	return shininess_int_ != 0;
+}
+
+int Material::shininessInt() const
+{
+	return shininess_int_;
+}
+
+uint64_t Material::hash(uint64_t seed) const
+{
+	seed = Util::hash64(ambient_reflection_.data(), sizeof(double) * 3, seed);
+	seed = Util::hash64(diffuse_reflection_.data(), sizeof(double) * 3, seed);
+	seed = Util::hash64(specular_reflection_.data(), sizeof(double) * 3, seed);
+	seed = Util::hash64(coherent_reflection_.data(), sizeof(double) * 3, seed);
+	return Util::hash64(&shininess_, sizeof(shininess_), seed);
+}
 
 Material Material::Generator(MaterialColor c, int opt)
 {
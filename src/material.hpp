@@ -32,7 +32,20 @@ public:
 
 	RGBd& coherent_reflection();
 	const RGBd& coherent_reflection() const;
+
+	// Determine which terms of the shading model are needed, has to be called again after modifying the material
+	void classify();
+
+	// Combination of MaterialOption flags, computed by classify()
+	int options() const;
+
+	// True if the shininess is a small positive integer, see shininessInt()
+	bool integerShininess() const;
+	int shininessInt() const;
 	
+	// Hash of all coefficients, used to detect changes of a scene
+	uint64_t hash(uint64_t seed) const;
+
 	static Material Generator(MaterialColor c, int opt);
 
 private:
@@ -41,4 +54,7 @@ private:
 	RGBd specular_reflection_;
 	RGBd coherent_reflection_;
 	double shininess_;
+
+	int options_;
+	int shininess_int_;
 };
\ No newline at end of file
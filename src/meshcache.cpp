@@ -0,0 +1,38 @@
+#include "meshcache.hpp"
+
+using namespace TriangularMesh;
+
+MeshCache::MeshCache(int threads, const std::string & cache_dir, bool reorder_faces, int lod_levels) :
+	threads_{ threads }, cache_dir_{ cache_dir }, reorder_faces_{ reorder_faces }, lod_levels_{ lod_levels }
+{
+}
+
+std::shared_ptr<const MeshData> MeshCache::load(const std::string & path, bool reverse_face_normal, bool interpolate_normals)
+{
+	std::string key = path;
+	key += reverse_face_normal ? "\n1" : "\n0";
+	key += interpolate_normals ? "1" : "0";
+
+	std::lock_guard<std::mutex> lock{ mutex_ };
+	std::shared_ptr<const MeshData> mesh = meshes_[key].lock();
+	if (!mesh) {
+		mesh = MeshData::loadFromPly(path.c_str(), reverse_face_normal, interpolate_normals, threads_, cache_dir_, reorder_faces_, lod_levels_);
+		if (mesh)
+			meshes_[key] = mesh;
+		else
+			meshes_.erase(key);
+	}
+	return mesh;
+}
+
+size_t MeshCache::size()
+{
+	std::lock_guard<std::mutex> lock{ mutex_ };
+	for (auto it = meshes_.begin(); it != meshes_.end();) {
+		if (it->second.expired())
+			it = meshes_.erase(it);
+		else
+			it++;
+	}
+	return meshes_.size();
+}
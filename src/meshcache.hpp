@@ -0,0 +1,29 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "meshdata.hpp"
+
+/// @brief Loads each mesh once, every load of the same file with the same options returns the same MeshData.
+/// Only weak references are kept, a mesh is freed when its last instance is gone.
+class MeshCache
+{
+public:
+	// Threads, cache directory, reordering and levels of detail are passed on to MeshData::loadFromPly()
+	MeshCache(int threads = 1, const std::string& cache_dir = "", bool reorder_faces = false, int lod_levels = 0);
+
+	// Shared geometry of a PLY file, nullptr if it cannot be loaded
+	std::shared_ptr<const TriangularMesh::MeshData> load(const std::string& path, bool reverse_face_normal, bool interpolate_normals);
+
+	// Number of meshes still in use
+	size_t size();
+
+private:
+	std::mutex mutex_;
+	std::map<std::string, std::weak_ptr<const TriangularMesh::MeshData>> meshes_;
+	int threads_;
+	std::string cache_dir_;
+	bool reorder_faces_;
+	int lod_levels_;
+};
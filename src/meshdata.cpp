@@ -0,0 +1,1074 @@
+#include "meshdata.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <cerrno>
+#include <limits>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+using namespace TriangularMesh;
+
+// Increase whenever the layout of the cached geometry changes
+static const uint32_t MESH_CACHE_VERSION = 3;
+static const char MESH_CACHE_MAGIC[8] = { 'R', 'T', 'M', 'E', 'S', 'H', '\n', 0 };
+static const int MESH_CACHE_ALIGNMENT = 64;
+
+// Name of the cache file of a mesh
+static std::string cachePath(const std::string& cache_dir, uint64_t key)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.mesh", static_cast<unsigned long long>(key));
+	return cache_dir + "/" + name;
+}
+
+// Call work(start, end) for consecutive ranges of [0,count) in parallel, every thread gets at least min_count
+static void parallelRanges(int count, int threads, int min_count, const std::function<void(int, int)>& work)
+{
+	threads = std::max(1, std::min(threads, count / min_count));
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; i++)
+		workers.push_back(std::thread(work, i * count / threads, (i + 1) * count / threads));
+	work(0, count / threads);
+	for (auto it = workers.begin(); it != workers.end(); it++)
+		it->join();
+}
+
+MeshData::MeshData(bool interpolate_normals) :
+	geometry_{ 4096, true }, bounding_box_{ Vec3::Zero(), Vec3::Zero(), Vec3::Zero(), Vec3::Zero(), 0, 0, 0 }, interpolate_normals_{ interpolate_normals }, hash_{ 0 }
+{
+}
+
+const Vertices & MeshData::vertices() const
+{
+	return vertices_;
+}
+
+const Faces & MeshData::faces() const
+{
+	return faces_;
+}
+
+Vec3 MeshData::vertex(Index i) const
+{
+	return vertices_[i].cast<double>();
+}
+
+PackedNormal MeshData::vertexNormal(Index i) const
+{
+	return vertex_normals_[i];
+}
+
+Vec3 MeshData::faceNormal(Index i) const
+{
+	return calcTriNormal(i).normalized();
+}
+
+const Box3 & MeshData::boundingBox() const
+{
+	return bounding_box_;
+}
+
+bool MeshData::interpolateNormals() const
+{
+	return interpolate_normals_;
+}
+
+uint64_t MeshData::hash() const
+{
+	return hash_;
+}
+
+const Arena::Stats & MeshData::geometryStats() const
+{
+	return geometry_.stats();
+}
+
+bool MeshData::fromCache() const
+{
+	return cache_file_.data() != nullptr;
+}
+
+int MeshData::levelCount() const
+{
+	return 1 + static_cast<int>(levels_.size());
+}
+
+const MeshData & MeshData::level(int i) const
+{
+	return i == 0 ? *this : *levels_[i - 1];
+}
+
+void MeshData::calcHash()
+{
+	hash_ = Util::hash64(vertices_.data(), vertices_.size() * sizeof(Vertex));
+	hash_ = Util::hash64(faces_.data(), faces_.size() * sizeof(Face), hash_);
+	hash_ = Util::hash64(&interpolate_normals_, sizeof(interpolate_normals_), hash_);
+}
+
+std::shared_ptr<MeshData> MeshData::createPyramid()
+{
+	std::shared_ptr<MeshData> mesh{ new MeshData{ false } };
+	mesh->allocateGeometry(4, 4);
+	mesh->vertices_[0] = Vertex{ 0,0,0 };
+	mesh->vertices_[1] = Vertex{ 1,0,0 };
+	mesh->vertices_[2] = Vertex{ 0,1,0 };
+	mesh->vertices_[3] = Vertex{ 0,0,1 };
+	mesh->faces_[0] = Face{0, 1, 2};
+	mesh->faces_[1] = Face{0, 3, 1};
+	mesh->faces_[2] = Face{0, 2, 3};
+	mesh->faces_[3] = Face{1, 3, 2};
+	mesh->calcNormals(1);
+	mesh->calcBoundingBox();
+	mesh->calcHash();
+	return mesh;
+}
+
+std::shared_ptr<MeshData> MeshData::loadFromPly(const char * path, bool reverse_face_normal, bool interpolate_normals, int threads, const std::string& cache_dir,
+	bool reorder_faces, int lod_levels)
+{
+	// The file is mapped instead of read, binary vertex and index data are taken directly from the mapped pages
+	MappedFile file;
+	if (!file.open(path)) {
+		std::cout << "Error opening " << path << std::endl;
+		return nullptr;
+	}
+
+	// The cache file is named after the contents of the source and everything else changing the geometry
+	std::string cache_path;
+	uint64_t cache_key = 0;
+	if (!cache_dir.empty()) {
+		cache_key = Util::hash64(file.data(), file.size());
+		cache_key = Util::hash64(&reverse_face_normal, sizeof(reverse_face_normal), cache_key);
+		cache_key = Util::hash64(&interpolate_normals, sizeof(interpolate_normals), cache_key);
+		cache_key = Util::hash64(&reorder_faces, sizeof(reorder_faces), cache_key);
+		cache_key = Util::hash64(&MESH_CACHE_VERSION, sizeof(MESH_CACHE_VERSION), cache_key);
+		cache_path = cachePath(cache_dir, cache_key);
+
+		std::shared_ptr<MeshData> mesh{ new MeshData{ interpolate_normals } };
+		if (mesh->loadCache(cache_path, cache_key)) {
+			mesh->buildLevels(lod_levels, threads, cache_dir, cache_key);
+			return mesh;
+		}
+	}
+	Ply::Header header;
+	Ply::MeshLayout layout;
+	if (!header.parse(file.data(), file.size()) || !layout.find(header))
+		return nullptr;
+
+	// Counts are checked against the file size before anything is allocated for them
+	const uint8_t* body = file.data() + header.size_;
+	const uint8_t* end = file.data() + file.size();
+	for (auto element = header.elements_.begin(); element != header.elements_.end(); element++) {
+		size_t item_size = header.format_ == Ply::Format::Ascii ? 1 : std::max<size_t>(1, element->minimumStride());
+		if (element->count_ > static_cast<size_t>(end - body) / item_size) {
+			std::cout << "Error reading ply: file too short for " << element->count_ << " " << element->name_ << " elements" << std::endl;
+			return nullptr;
+		}
+	}
+
+	size_t vertex_count = header.elements_[layout.vertex_element_].count_;
+	size_t face_count = header.elements_[layout.face_element_].count_;
+	std::shared_ptr<MeshData> mesh{ new MeshData{ interpolate_normals } };
+	mesh->allocateGeometry(vertex_count, face_count);
+
+	bool ok;
+	if (header.format_ == Ply::Format::Ascii)
+		ok = mesh->readPlyAscii(header, layout, body, end, reverse_face_normal, threads);
+	else
+		ok = mesh->readPlyBinary(header, layout, body, end, reverse_face_normal);
+	for (size_t i = 0; ok && i < face_count; i++) {
+		const Face& f = mesh->faces_[i];
+		if (std::min({ f[0], f[1], f[2] }) < 0 || static_cast<size_t>(std::max({ f[0], f[1], f[2] })) >= vertex_count) {
+			std::cout << "error reading face " << i << ": vertex index out of range" << std::endl;
+			ok = false;
+		}
+	}
+	if (!ok)
+		return nullptr;
+
+	mesh->calcBoundingBox();
+	if (reorder_faces)
+		mesh->reorderFaces(threads);
+	mesh->calcNormals(threads);
+	mesh->calcHash();
+
+	if (!cache_path.empty() && !mesh->writeCache(cache_path, cache_key))
+		std::cout << "Error writing mesh cache " << cache_path << std::endl;
+
+	mesh->buildLevels(lod_levels, threads, cache_dir, cache_key);
+	return mesh;
+}
+
+// Skip blanks up to the next token, false if it is not a plain decimal number. strtod and strtol would skip any other white space
+// including the line break and accept nan, inf and hex floats, which are no numbers of a PLY file.
+static bool skipToNumber(const char** text, const char* line_end)
+{
+	while (*text < line_end && (**text == ' ' || **text == '\t' || **text == '\r'))
+		(*text)++;
+	const char* t = *text;
+	if (t < line_end && (*t == '+' || *t == '-'))
+		t++;
+	if (t >= line_end)
+		return false;
+	if (*t == '0' && t + 1 < line_end && (t[1] == 'x' || t[1] == 'X'))
+		return false;
+	return (*t >= '0' && *t <= '9') || *t == '.';
+}
+
+// Parse a number with strtod or strtol, numbers reaching past line_end are rejected
+static bool parseDouble(const char** text, const char* line_end, double* value)
+{
+	if (!skipToNumber(text, line_end))
+		return false;
+	char* number_end;
+	*value = std::strtod(*text, &number_end);
+	if (number_end == *text || number_end > line_end || !std::isfinite(*value))
+		return false;
+	*text = number_end;
+	return true;
+}
+
+static bool parseInt(const char** text, const char* line_end, int* value)
+{
+	if (!skipToNumber(text, line_end))
+		return false;
+	char* number_end;
+	errno = 0;
+	long number = std::strtol(*text, &number_end, 10);
+	if (number_end == *text || number_end > line_end || errno == ERANGE || number < std::numeric_limits<int>::min() || number > std::numeric_limits<int>::max())
+		return false;
+	*value = static_cast<int>(number);
+	*text = number_end;
+	return true;
+}
+
+AsciiError MeshData::parsePlyAsciiLine(const Ply::Element & element, bool vertex, bool face, const Ply::MeshLayout & layout, size_t item, const int* face_order, const char* text, const char* line_end)
+{
+	double value;
+	if (vertex) {
+		// Every property is read to get to the coordinates, lists are skipped
+		for (int p = 0; p < static_cast<int>(element.properties_.size()); p++) {
+			if (element.properties_[p].list_) {
+				int count;
+				if (!parseInt(&text, line_end, &count) || count < 0)
+					return AsciiError::Syntax;
+				for (int k = 0; k < count; k++) {
+					if (!parseDouble(&text, line_end, &value))
+						return AsciiError::Syntax;
+				}
+				continue;
+			}
+			if (!parseDouble(&text, line_end, &value))
+				return AsciiError::Syntax;
+			if (p == layout.x_)
+				vertices_[item](face_order[0]) = value;
+			else if (p == layout.y_)
+				vertices_[item](face_order[1]) = value;
+			else if (p == layout.z_)
+				vertices_[item](face_order[2]) = value;
+		}
+	}
+	else if (face) {
+		for (int p = 0; p < static_cast<int>(element.properties_.size()); p++) {
+			if (!element.properties_[p].list_) {
+				if (!parseDouble(&text, line_end, &value))
+					return AsciiError::Syntax;
+				continue;
+			}
+			int poly_number;
+			if (!parseInt(&text, line_end, &poly_number) || poly_number < 0)
+				return AsciiError::Syntax;
+			if (p == layout.indices_) {
+				if (poly_number != 3)
+					return AsciiError::NotTriangle;
+				for (int k = 0; k < 3; k++) {
+					if (!parseInt(&text, line_end, &faces_[item][k]))
+						return AsciiError::Syntax;
+				}
+				continue;
+			}
+			for (int k = 0; k < poly_number; k++) {
+				if (!parseDouble(&text, line_end, &value))
+					return AsciiError::Syntax;
+			}
+		}
+	}
+	return AsciiError::None;
+}
+
+bool MeshData::readPlyAscii(const Ply::Header & header, const Ply::MeshLayout & layout, const uint8_t * data, const uint8_t * end, bool reverse_face_normal, int threads)
+{
+	const char* text = reinterpret_cast<const char*>(data);
+	const char* text_end = reinterpret_cast<const char*>(end);
+	int face_order[3] = { 0,1,2 };
+	if (reverse_face_normal) {
+		face_order[0] = 2;
+		face_order[2] = 0;
+	}
+
+	// One line per item, element e covers the lines [first_line[e], first_line[e+1])
+	std::vector<size_t> first_line(header.elements_.size() + 1, 0);
+	for (size_t e = 0; e < header.elements_.size(); e++)
+		first_line[e + 1] = first_line[e] + header.elements_[e].count_;
+	const size_t line_count = first_line.back();
+
+	// The text is split into blocks of whole lines, each thread counts the lines of its blocks first and then parses them
+	const int MIN_BLOCK_SIZE = 1 << 20;
+	int block_count = static_cast<int>(std::max<ptrdiff_t>(1, std::min<ptrdiff_t>(std::max(1, threads) * 4, (text_end - text) / MIN_BLOCK_SIZE)));
+	std::vector<const char*> block_start(block_count + 1, text_end);
+	block_start[0] = text;
+	for (int b = 1; b < block_count; b++) {
+		const char* split = std::max(block_start[b - 1], text + (text_end - text) * b / block_count);
+		const char* line_end = static_cast<const char*>(std::memchr(split, '\n', text_end - split));
+		block_start[b] = line_end ? line_end + 1 : text_end;
+	}
+
+	std::vector<size_t> block_lines(block_count + 1, 0);
+	parallelRanges(block_count, threads, 1, [&](int start, int end) {
+		for (int b = start; b < end; b++) {
+			size_t lines = 0;
+			for (const char* t = block_start[b]; t < block_start[b + 1]; t++) {
+				t = static_cast<const char*>(std::memchr(t, '\n', block_start[b + 1] - t));
+				if (t == nullptr)
+					break;
+				lines++;
+			}
+			// The last line may lack the line break
+			if (block_start[b + 1] == text_end && block_start[b + 1] > block_start[b] && text_end[-1] != '\n')
+				lines++;
+			block_lines[b + 1] = lines;
+		}
+	});
+	for (int b = 0; b < block_count; b++)
+		block_lines[b + 1] += block_lines[b];
+
+	// First error of each block, reported in the order of the file
+	std::vector<size_t> error_line(block_count, line_count);
+	std::vector<AsciiError> error(block_count, AsciiError::None);
+	parallelRanges(block_count, threads, 1, [&](int start, int end) {
+		for (int b = start; b < end; b++) {
+			size_t line = block_lines[b];
+			size_t e = 0;
+			for (const char* t = block_start[b]; t < block_start[b + 1] && line < line_count; line++) {
+				const char* line_end = static_cast<const char*>(std::memchr(t, '\n', block_start[b + 1] - t));
+				std::string last_line;
+				if (line_end == nullptr) {
+					// strtod needs a terminated string, the mapping ends right after this line
+					last_line.assign(t, block_start[b + 1]);
+					t = last_line.c_str();
+					line_end = t + last_line.size();
+				}
+				while (line >= first_line[e + 1])
+					e++;
+
+				int element = static_cast<int>(e);
+				AsciiError result = parsePlyAsciiLine(header.elements_[e], element == layout.vertex_element_, element == layout.face_element_,
+					layout, line - first_line[e], face_order, t, line_end);
+				if (result != AsciiError::None) {
+					error[b] = result;
+					error_line[b] = line;
+					break;
+				}
+				t = last_line.empty() ? line_end + 1 : block_start[b + 1];
+			}
+		}
+	});
+
+	size_t bad_line = block_lines.back(); // first missing line, if any
+	AsciiError bad_error = AsciiError::Syntax;
+	for (int b = 0; b < block_count; b++) {
+		if (error[b] != AsciiError::None && error_line[b] < bad_line) {
+			bad_line = error_line[b];
+			bad_error = error[b];
+		}
+	}
+	if (bad_line >= line_count)
+		return true;
+
+	size_t e = 0;
+	while (bad_line >= first_line[e + 1])
+		e++;
+	size_t item = bad_line - first_line[e];
+	if (bad_error == AsciiError::NotTriangle)
+		std::cout << "Unsupported Ply file, only triangular faces supported" << std::endl;
+	else if (static_cast<int>(e) == layout.vertex_element_)
+		std::cout << "error reading vertex " << item << std::endl;
+	else if (static_cast<int>(e) == layout.face_element_)
+		std::cout << "error reading face " << item << std::endl;
+	else
+		std::cout << "error reading " << header.elements_[e].name_ << " " << item << std::endl;
+	return false;
+}
+
+// Walk over one item of a binary element, the indices of a triangle are stored if the list property index_property is found
+// and the values of the three scalar properties coordinates[] in values[] if given.
+// Returns the start of the next item or nullptr if the file is too short or the face is not a triangle.
+static const uint8_t* readBinaryItem(const Ply::Element& element, const uint8_t* data, const uint8_t* end, bool swap_bytes, int index_property, Face* face,
+	const int* coordinates = nullptr, double* values = nullptr)
+{
+	for (int p = 0; p < static_cast<int>(element.properties_.size()); p++) {
+		const Ply::Property& property = element.properties_[p];
+		if (!property.list_) {
+			size_t size = Ply::typeSize(property.type_);
+			if (static_cast<size_t>(end - data) < size)
+				return nullptr;
+			for (int k = 0; coordinates != nullptr && k < 3; k++) {
+				if (p == coordinates[k])
+					values[k] = Ply::readValue(data, property.type_, swap_bytes);
+			}
+			data += size;
+			continue;
+		}
+
+		size_t count_size = Ply::typeSize(property.count_type_);
+		size_t item_size = Ply::typeSize(property.type_);
+		if (static_cast<size_t>(end - data) < count_size)
+			return nullptr;
+		double count = Ply::readValue(data, property.count_type_, swap_bytes);
+		data += count_size;
+		if (count < 0 || static_cast<size_t>(end - data) / item_size < count)
+			return nullptr;
+		if (p == index_property) {
+			if (count != 3) {
+				std::cout << "Unsupported Ply file, only triangular faces supported" << std::endl;
+				return nullptr;
+			}
+			for (int k = 0; k < 3; k++)
+				(*face)[k] = static_cast<Index>(Ply::readValue(data + k * item_size, property.type_, swap_bytes));
+		}
+		data += static_cast<size_t>(count) * item_size;
+	}
+	return data;
+}
+
+bool MeshData::readPlyBinary(const Ply::Header & header, const Ply::MeshLayout & layout, const uint8_t * data, const uint8_t * end, bool reverse_face_normal)
+{
+	const bool swap_bytes = header.swapBytes();
+	int face_order[3] = { 0,1,2 };
+	if (reverse_face_normal) {
+		face_order[0] = 2;
+		face_order[2] = 0;
+	}
+
+	for (int e = 0; e < static_cast<int>(header.elements_.size()); e++) {
+		const Ply::Element& element = header.elements_[e];
+		size_t stride = element.stride();
+
+		if (e == layout.vertex_element_) {
+			const int coordinates[3] = { layout.x_, layout.y_, layout.z_ };
+			if (stride == 0) {
+				// Vertices with list properties vary in size and are walked property by property
+				for (size_t i = 0; i < element.count_; i++) {
+					double values[3];
+					data = readBinaryItem(element, data, end, swap_bytes, -1, nullptr, coordinates, values);
+					if (data == nullptr) {
+						std::cout << "error reading vertex " << i << std::endl;
+						return false;
+					}
+					for (int k = 0; k < 3; k++)
+						vertices_[i](face_order[k]) = static_cast<float>(values[k]);
+				}
+				continue;
+			}
+			if (element.count_ > static_cast<size_t>(end - data) / stride) {
+				std::cout << "error reading vertices, file too short" << std::endl;
+				return false;
+			}
+
+			// Vertices have a fixed size, the coordinates are read at fixed offsets
+			size_t offsets[3];
+			Ply::Type types[3];
+			for (int k = 0; k < 3; k++) {
+				offsets[k] = 0;
+				for (int p = 0; p < coordinates[k]; p++)
+					offsets[k] += Ply::typeSize(element.properties_[p].type_);
+				types[k] = element.properties_[coordinates[k]].type_;
+			}
+			for (size_t i = 0; i < element.count_; i++, data += stride) {
+				for (int k = 0; k < 3; k++)
+					vertices_[i](face_order[k]) = Ply::readValue(data + offsets[k], types[k], swap_bytes);
+			}
+		}
+		else if (e == layout.face_element_) {
+			for (size_t i = 0; i < element.count_; i++) {
+				data = readBinaryItem(element, data, end, swap_bytes, layout.indices_, &faces_[i]);
+				if (data == nullptr) {
+					std::cout << "error reading face " << i << std::endl;
+					return false;
+				}
+			}
+		}
+		else if (stride > 0) {
+			if (element.count_ > static_cast<size_t>(end - data) / stride) {
+				std::cout << "error reading " << element.name_ << ", file too short" << std::endl;
+				return false;
+			}
+			data += element.count_ * stride;
+		}
+		else {
+			for (size_t i = 0; i < element.count_; i++) {
+				data = readBinaryItem(element, data, end, swap_bytes, -1, nullptr);
+				if (data == nullptr) {
+					std::cout << "error reading " << element.name_ << " " << i << std::endl;
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool MeshData::calcTriIntersect(Index i, const Ray & r, double * distance, Vec2 * uv) const
+{
+	return intersectTriangle(vertex(faces_[i][0]), vertex(faces_[i][1]), vertex(faces_[i][2]), r, distance, uv);
+}
+
+bool MeshData::intersectTriangle(const Vec3 & A, const Vec3 & B, const Vec3 & C, const Ray & r, double * distance, Vec2 * uv)
+{
+	// Calculate (if it exists) the intersection point P on the plane defined by the triangle 
+	const Vec3 n = (C - A).cross(B - A);
+	double ray_on_normal_proj = r.dir().dot(n);
+	if (std::abs(ray_on_normal_proj) < EPS) {
+		// ray is in parallel of the plane, no intersection
+		return false;
+	}
+	//if (ray_on_normal_proj > 0) {
+	//	return false; // ray is coming from behind
+	//}
+	*distance = (A.dot(n) - r.pos().dot(n)) / ray_on_normal_proj;
+	Vec3 point = r.pos() + *distance * r.dir();
+
+	//if (*distance < 0)
+	//	return false;
+
+	// Check if the intersection point is inside the triangle.
+	Eigen::Matrix<double,3,2> UV;
+	UV.col(0) = C - A;
+	UV.col(1) = B - A;
+	*uv = (UV.transpose() * UV).ldlt().solve(UV.transpose() * (point-A));
+	if ((uv->array() < 0).any() || uv->sum() > 1) {
+		// P is NOT inside the triangle.
+		return false;
+	}
+	return true;
+}
+
+
+Vec3 MeshData::calcPhongNormalInterpolation(Index i, double u, double v) const
+{
+	double gamma = u;
+	double beta = v;
+	double alpha = 1 - beta - gamma;
+
+	const Vec3 n_A = decodeNormal(vertex_normals_[faces_[i][0]]);
+	const Vec3 n_B = decodeNormal(vertex_normals_[faces_[i][1]]);
+	const Vec3 n_C = decodeNormal(vertex_normals_[faces_[i][2]]);
+
+	Vec3 n = alpha * n_A + beta * n_B + gamma * n_C;
+
+	n.normalize();
+	return n;
+}
+
+Vec3 MeshData::calcTriNormal(Index i) const
+{
+	const Vec3 A = vertex(faces_[i][0]);
+	const Vec3 B = vertex(faces_[i][1]);
+	const Vec3 C = vertex(faces_[i][2]);
+	Vec3 n = (C - A).cross(B - A);
+	return n;
+}
+
+// Octahedral encoding: the unit sphere is projected onto the octahedron |x|+|y|+|z|=1, whose lower half is folded over the upper one
+// into the square [-1,1]^2. Both coordinates are stored as signed 16 bit values, the error is below 1e-4 radians.
+PackedNormal MeshData::encodeNormal(const Vec3 & n)
+{
+	double l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+	if (l1 == 0)
+		return 0;
+	double x = n.x() / l1;
+	double y = n.y() / l1;
+	if (n.z() < 0) {
+		double folded_x = (1 - std::abs(y)) * (x < 0 ? -1 : 1);
+		y = (1 - std::abs(x)) * (y < 0 ? -1 : 1);
+		x = folded_x;
+	}
+	int16_t qx = static_cast<int16_t>(std::lround(std::max(-1.0, std::min(1.0, x)) * 32767));
+	int16_t qy = static_cast<int16_t>(std::lround(std::max(-1.0, std::min(1.0, y)) * 32767));
+	return static_cast<uint16_t>(qx) | static_cast<PackedNormal>(static_cast<uint16_t>(qy)) << 16;
+}
+
+Vec3 MeshData::decodeNormal(PackedNormal n)
+{
+	double x = static_cast<int16_t>(n & 0xffff) / 32767.0;
+	double y = static_cast<int16_t>(n >> 16) / 32767.0;
+	double z = 1 - std::abs(x) - std::abs(y);
+	if (z < 0) {
+		double unfolded_x = (1 - std::abs(y)) * (x < 0 ? -1 : 1);
+		y = (1 - std::abs(x)) * (y < 0 ? -1 : 1);
+		x = unfolded_x;
+	}
+	return Vec3{ x, y, z }.normalized();
+}
+
+void MeshData::calcNormals(int threads)
+{
+	const int face_count = static_cast<int>(faces_.size());
+	const int vertex_count = static_cast<int>(vertices_.size());
+	// Faces connected to each vertex as compressed rows: the faces of vertex v are adjacent[offsets[v]] to adjacent[offsets[v+1]-1].
+	// They are in increasing order, so the sums below do not depend on the number of threads.
+	std::vector<Index> offsets(vertex_count + 1, 0);
+	for (int i = 0; i < face_count; i++) {
+		const Face& f = faces_[i];
+		offsets[f[0] + 1]++;
+		if (f[1] != f[0])
+			offsets[f[1] + 1]++;
+		if (f[2] != f[0] && f[2] != f[1])
+			offsets[f[2] + 1]++;
+	}
+	for (int v = 0; v < vertex_count; v++)
+		offsets[v + 1] += offsets[v];
+
+	std::vector<Index> adjacent(offsets.back());
+	std::vector<Index> next(offsets.begin(), offsets.end() - 1);
+	for (int i = 0; i < face_count; i++) {
+		const Face& f = faces_[i];
+		adjacent[next[f[0]]++] = i;
+		if (f[1] != f[0])
+			adjacent[next[f[1]]++] = i;
+		if (f[2] != f[0] && f[2] != f[1])
+			adjacent[next[f[2]]++] = i;
+	}
+
+	// Calculate normals for each vertex, the unnormalized face normals weight the faces by their area.
+	// Face normals are not stored, each is calculated again for its three vertices.
+	parallelRanges(vertex_count, threads, 10000, [&](int start, int end) {
+		for (int v = start; v < end; v++) {
+			Vec3 mean_normal = Vec3::Zero();
+			for (int k = offsets[v]; k < offsets[v + 1]; k++)
+				mean_normal += calcTriNormal(adjacent[k]);
+			vertex_normals_[v] = encodeNormal(mean_normal.normalized());
+		}
+	});
+}
+
+// Spread the lowest 21 bits of x to every third bit
+static uint64_t expandMortonBits(uint64_t x)
+{
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffffull;
+	x = (x | x << 16) & 0x1f0000ff0000ffull;
+	x = (x | x << 8) & 0x100f00f00f00f00full;
+	x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+	x = (x | x << 2) & 0x1249249249249249ull;
+	return x;
+}
+
+void MeshData::reorderFaces(int threads)
+{
+	const int face_count = static_cast<int>(faces_.size());
+	const int vertex_count = static_cast<int>(vertices_.size());
+
+	// Centroids are quantized to 21 bits per axis inside the bounding box, ties keep the order of the file
+	const Vec3 lower = bounding_box_.center() - bounding_box_.lengths();
+	const Vec3 extent = 2 * bounding_box_.lengths();
+	const double CELLS = (1 << 21) - 1;
+	std::vector<std::pair<uint64_t, Index>> order(face_count);
+	parallelRanges(face_count, threads, 10000, [&](int start, int end) {
+		for (int i = start; i < end; i++) {
+			const Face& f = faces_[i];
+			Vec3 centroid = (vertex(f[0]) + vertex(f[1]) + vertex(f[2])) / 3;
+			uint64_t code = 0;
+			for (int k = 0; k < 3; k++) {
+				double t = extent[k] > 0 ? (centroid[k] - lower[k]) / extent[k] : 0;
+				code |= expandMortonBits(static_cast<uint64_t>(std::max(0.0, std::min(1.0, t)) * CELLS)) << k;
+			}
+			order[i] = std::make_pair(code, i);
+		}
+	});
+	std::sort(order.begin(), order.end());
+
+	std::vector<Face> sorted_faces(face_count);
+	for (int i = 0; i < face_count; i++)
+		sorted_faces[i] = faces_[order[i].second];
+
+	// New index of every vertex in the order of first use by the sorted faces
+	std::vector<Index> new_index(vertex_count, -1);
+	Index next = 0;
+	for (auto f = sorted_faces.begin(); f != sorted_faces.end(); f++) {
+		for (int k = 0; k < 3; k++) {
+			if (new_index[(*f)[k]] < 0)
+				new_index[(*f)[k]] = next++;
+			(*f)[k] = new_index[(*f)[k]];
+		}
+	}
+	for (int v = 0; v < vertex_count; v++) {
+		if (new_index[v] < 0)
+			new_index[v] = next++;
+	}
+
+	std::vector<Vertex> sorted_vertices(vertex_count);
+	for (int v = 0; v < vertex_count; v++)
+		sorted_vertices[new_index[v]] = vertices_[v];
+	std::copy(sorted_faces.begin(), sorted_faces.end(), faces_.begin());
+	std::copy(sorted_vertices.begin(), sorted_vertices.end(), vertices_.begin());
+}
+
+std::unique_ptr<MeshData> MeshData::simplify(size_t target_faces, int threads) const
+{
+	using Quadric = Eigen::Matrix4d;
+	const int vertex_count = static_cast<int>(vertices_.size());
+	std::vector<Vec3> positions(vertex_count);
+	for (int v = 0; v < vertex_count; v++)
+		positions[v] = vertex(v);
+	std::vector<Face> faces(faces_.begin(), faces_.end());
+
+	// Edge as pair of vertex indices, the smaller one in the upper half
+	auto edgeKey = [](Index a, Index b) {
+		return static_cast<uint64_t>(std::min(a, b)) << 32 | static_cast<uint32_t>(std::max(a, b));
+	};
+
+	// Edges not shared by exactly two faces are on the boundary or non-manifold, their vertices are never moved
+	std::vector<bool> locked(vertex_count, false);
+	{
+		std::vector<uint64_t> edges;
+		edges.reserve(3 * faces.size());
+		for (auto f = faces.begin(); f != faces.end(); f++) {
+			for (int k = 0; k < 3; k++)
+				edges.push_back(edgeKey((*f)[k], (*f)[(k + 1) % 3]));
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();) {
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			if (j - i != 2) {
+				locked[edges[i] >> 32] = true;
+				locked[edges[i] & 0xffffffff] = true;
+			}
+			i = j;
+		}
+	}
+
+	// Every pass collapses a set of edges without common vertices, cheapest first
+	std::vector<Quadric, Eigen::aligned_allocator<Quadric>> quadrics;
+	std::vector<Index> collapse_of(vertex_count);
+	while (faces.size() > target_faces) {
+		// Sum of the squared distances to the planes of the adjacent faces, weighted by their area
+		quadrics.assign(vertex_count, Quadric::Zero());
+		double area = 0;
+		for (auto f = faces.begin(); f != faces.end(); f++) {
+			const Vec3& A = positions[(*f)[0]];
+			Vec3 n = (positions[(*f)[2]] - A).cross(positions[(*f)[1]] - A);
+			double length = n.norm();
+			if (length == 0)
+				continue;
+			Eigen::Vector4d plane;
+			plane << n / length, -n.dot(A) / length;
+			Quadric q = length / 2 * plane * plane.transpose();
+			area += length / 2;
+			for (int k = 0; k < 3; k++)
+				quadrics[(*f)[k]] += q;
+		}
+
+		// The root mean squared distance of a collapse is limited to half the size of the faces of the target, about half a pixel
+		// when the level is selected. The trace of the quadric is the area it is weighted with.
+		const double max_error = area / target_faces / 4;
+
+		// Interior edges appear once in each direction, they are taken from the face where they go up
+		std::vector<std::pair<double, uint64_t>> candidates;
+		for (auto f = faces.begin(); f != faces.end(); f++) {
+			for (int k = 0; k < 3; k++) {
+				Index a = (*f)[k], b = (*f)[(k + 1) % 3];
+				if (a > b || locked[a] || locked[b])
+					continue;
+				Eigen::Vector4d midpoint;
+				midpoint << (positions[a] + positions[b]) / 2, 1;
+				Quadric q = quadrics[a] + quadrics[b];
+				double error = midpoint.dot(q * midpoint) / std::max(q.topLeftCorner<3, 3>().trace(), EPS);
+				if (error <= max_error)
+					candidates.push_back(std::make_pair(error, edgeKey(a, b)));
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		// An interior collapse removes two faces
+		std::vector<std::pair<Index, Index>> collapses;
+		std::vector<Vec3> midpoints;
+		std::vector<bool> rejected;
+		std::fill(collapse_of.begin(), collapse_of.end(), -1);
+		const size_t max_collapses = (faces.size() - target_faces + 1) / 2;
+		for (auto c = candidates.begin(); c != candidates.end() && collapses.size() < max_collapses; c++) {
+			Index a = static_cast<Index>(c->second >> 32), b = static_cast<Index>(c->second & 0xffffffff);
+			if (collapse_of[a] >= 0 || collapse_of[b] >= 0)
+				continue;
+			collapse_of[a] = collapse_of[b] = static_cast<Index>(collapses.size());
+			collapses.push_back(std::make_pair(a, b));
+			midpoints.push_back((positions[a] + positions[b]) / 2);
+		}
+		if (collapses.empty())
+			break;
+		rejected.assign(collapses.size(), false);
+
+		// Reject the collapses turning a remaining face around
+		auto collapsedIndex = [&](Index v) {
+			return collapse_of[v] >= 0 ? collapses[collapse_of[v]].first : v;
+		};
+		auto collapsedPosition = [&](Index v) {
+			return collapse_of[v] >= 0 ? midpoints[collapse_of[v]] : positions[v];
+		};
+		for (auto f = faces.begin(); f != faces.end(); f++) {
+			const Face& g = *f;
+			if (collapse_of[g[0]] < 0 && collapse_of[g[1]] < 0 && collapse_of[g[2]] < 0)
+				continue;
+			Index a = collapsedIndex(g[0]), b = collapsedIndex(g[1]), c = collapsedIndex(g[2]);
+			if (a == b || b == c || a == c)
+				continue;
+			Vec3 before = (positions[g[2]] - positions[g[0]]).cross(positions[g[1]] - positions[g[0]]);
+			Vec3 after = (collapsedPosition(g[2]) - collapsedPosition(g[0])).cross(collapsedPosition(g[1]) - collapsedPosition(g[0]));
+			if (before.dot(after) <= 0) {
+				for (int k = 0; k < 3; k++) {
+					if (collapse_of[g[k]] >= 0)
+						rejected[collapse_of[g[k]]] = true;
+				}
+			}
+		}
+		for (size_t i = 0; i < collapses.size(); i++) {
+			if (rejected[i]) {
+				collapse_of[collapses[i].first] = -1;
+				collapse_of[collapses[i].second] = -1;
+			}
+			else
+				positions[collapses[i].first] = midpoints[i];
+		}
+
+		// Faces with two collapsed vertices are gone
+		size_t remaining = 0;
+		for (size_t i = 0; i < faces.size(); i++) {
+			Face f = faces[i];
+			for (int k = 0; k < 3; k++)
+				f[k] = collapsedIndex(f[k]);
+			if (f[0] != f[1] && f[1] != f[2] && f[0] != f[2])
+				faces[remaining++] = f;
+		}
+		if (remaining == faces.size())
+			break;
+		faces.resize(remaining);
+	}
+
+	// Remaining vertices keep their order
+	std::vector<Index> new_index(vertex_count, -1);
+	for (auto f = faces.begin(); f != faces.end(); f++) {
+		for (int k = 0; k < 3; k++)
+			new_index[(*f)[k]] = 0;
+	}
+	Index used = 0;
+	for (int v = 0; v < vertex_count; v++) {
+		if (new_index[v] >= 0)
+			new_index[v] = used++;
+	}
+
+	std::unique_ptr<MeshData> mesh{ new MeshData{ interpolate_normals_ } };
+	mesh->allocateGeometry(used, faces.size());
+	for (int v = 0; v < vertex_count; v++) {
+		if (new_index[v] >= 0)
+			mesh->vertices_[new_index[v]] = positions[v].cast<float>();
+	}
+	for (size_t i = 0; i < faces.size(); i++) {
+		for (int k = 0; k < 3; k++)
+			mesh->faces_[i][k] = new_index[faces[i][k]];
+	}
+	mesh->calcNormals(threads);
+	mesh->calcBoundingBox();
+	mesh->calcHash();
+	return mesh;
+}
+
+void MeshData::buildLevels(int count, int threads, const std::string & cache_dir, uint64_t key)
+{
+	// Levels below this size would not save anything
+	const size_t MIN_FACES = 64;
+	const MeshData* previous = this;
+	for (int i = 1; i <= count && previous->faces_.size() >= 2 * MIN_FACES; i++) {
+		// Each level is cached in a file of its own, named after the key of the mesh and the level
+		std::unique_ptr<MeshData> level;
+		std::string cache_path;
+		uint64_t level_key = Util::hash64(&i, sizeof(i), key);
+		if (!cache_dir.empty()) {
+			cache_path = cachePath(cache_dir, level_key);
+			level.reset(new MeshData{ interpolate_normals_ });
+			if (!level->loadCache(cache_path, level_key))
+				level.reset();
+		}
+		if (!level) {
+			// A level is only worth it if the error bound let it remove a good part of the faces
+			level = previous->simplify(previous->faces_.size() / 2, threads);
+			if (level->faces_.size() > previous->faces_.size() * 3 / 4)
+				break;
+			if (!cache_path.empty() && !level->writeCache(cache_path, level_key))
+				std::cout << "Error writing mesh cache " << cache_path << std::endl;
+		}
+		levels_.push_back(std::move(level));
+		previous = levels_.back().get();
+	}
+}
+
+void MeshData::allocateGeometry(size_t vertex_count, size_t face_count)
+{
+	// Vertices and their normals, faces, plus alignment padding of every array
+	size_t bytes = vertex_count * (sizeof(Vertex) + sizeof(PackedNormal)) + face_count * sizeof(Face) + 3 * alignof(std::max_align_t);
+	geometry_.reserve(bytes);
+	vertices_ = Vertices{ geometry_.allocateArray<Vertex>(vertex_count), vertex_count };
+	faces_ = Faces{ geometry_.allocateArray<Face>(face_count), face_count };
+	vertex_normals_ = ArrayView<PackedNormal>{ geometry_.allocateArray<PackedNormal>(vertex_count), vertex_count };
+}
+
+bool MeshData::loadCache(const std::string & path, uint64_t key)
+{
+	// The arrays are used directly for rendering, so they are read in random order for as long as the mesh exists
+	if (!cache_file_.open(path.c_str(), MappedFile::Access::Random))
+		return false;
+
+	CacheHeader header;
+	bool valid = cache_file_.size() >= sizeof(header);
+	if (valid) {
+		std::memcpy(&header, cache_file_.data(), sizeof(header));
+		valid = std::memcmp(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic)) == 0 && header.version == MESH_CACHE_VERSION
+			&& header.byte_order == 0x01020304 && header.vertex_size == sizeof(Vertex) && header.face_size == sizeof(Face)
+			&& header.normal_size == sizeof(PackedNormal) && header.key == key;
+	}
+	const uint64_t counts[3] = { header.vertex_count, header.face_count, header.vertex_count };
+	const uint64_t sizes[3] = { sizeof(Vertex), sizeof(Face), sizeof(PackedNormal) };
+	for (int i = 0; i < 3 && valid; i++)
+		valid = header.offsets[i] % MESH_CACHE_ALIGNMENT == 0 && header.offsets[i] <= cache_file_.size() && counts[i] <= (cache_file_.size() - header.offsets[i]) / sizes[i];
+	if (!valid) {
+		std::cout << "Ignoring outdated mesh cache " << path << std::endl;
+		cache_file_.close();
+		return false;
+	}
+
+	// The arrays are used in place, the mapping is read only and they are never written after loading
+	uint8_t* data = const_cast<uint8_t*>(cache_file_.data());
+
+	// Indices are checked once like those of a PLY file, a damaged file must not lead to reads outside the vertices
+	const Face* faces = reinterpret_cast<const Face*>(data + header.offsets[1]);
+	for (uint64_t i = 0; i < header.face_count && valid; i++) {
+		for (int k = 0; k < 3; k++)
+			valid = valid && faces[i][k] >= 0 && static_cast<uint64_t>(faces[i][k]) < header.vertex_count;
+	}
+	if (!valid) {
+		std::cout << "Ignoring damaged mesh cache " << path << std::endl;
+		cache_file_.close();
+		return false;
+	}
+
+	vertices_ = Vertices{ reinterpret_cast<Vertex*>(data + header.offsets[0]), header.vertex_count };
+	faces_ = Faces{ reinterpret_cast<Face*>(data + header.offsets[1]), header.face_count };
+	vertex_normals_ = ArrayView<PackedNormal>{ reinterpret_cast<PackedNormal*>(data + header.offsets[2]), header.vertex_count };
+	bounding_box_ = Box3{ Vec3{ header.center[0], header.center[1], header.center[2] }, Vec3::UnitX(), Vec3::UnitY(), Vec3::UnitZ(),
+		header.lengths[0], header.lengths[1], header.lengths[2] };
+	hash_ = header.hash;
+	return true;
+}
+
+bool MeshData::writeCache(const std::string & path, uint64_t key) const
+{
+	CacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+	header.version = MESH_CACHE_VERSION;
+	header.byte_order = 0x01020304;
+	header.vertex_size = sizeof(Vertex);
+	header.face_size = sizeof(Face);
+	header.normal_size = sizeof(PackedNormal);
+	header.key = key;
+	header.hash = hash_;
+	header.vertex_count = vertices_.size();
+	header.face_count = faces_.size();
+	for (int k = 0; k < 3; k++) {
+		header.center[k] = bounding_box_.center()[k];
+		header.lengths[k] = bounding_box_.lengths()[k];
+	}
+
+	const void* arrays[3] = { vertices_.data(), faces_.data(), vertex_normals_.data() };
+	const uint64_t bytes[3] = { vertices_.size() * sizeof(Vertex), faces_.size() * sizeof(Face), vertex_normals_.size() * sizeof(PackedNormal) };
+	uint64_t offset = sizeof(header);
+	for (int i = 0; i < 3; i++) {
+		offset = (offset + MESH_CACHE_ALIGNMENT - 1) / MESH_CACHE_ALIGNMENT * MESH_CACHE_ALIGNMENT;
+		header.offsets[i] = offset;
+		offset += bytes[i];
+	}
+
+	// Written under a temporary name and renamed, workers loading the same mesh at the same time may race for it
+	std::string tmp_path = path + ".tmp" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+	std::ofstream file{ tmp_path, std::ios::binary };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	uint64_t position = sizeof(header);
+	const char padding[MESH_CACHE_ALIGNMENT] = {};
+	for (int i = 0; i < 3; i++) {
+		file.write(padding, header.offsets[i] - position);
+		file.write(static_cast<const char*>(arrays[i]), bytes[i]);
+		position = header.offsets[i] + bytes[i];
+	}
+	file.close();
+	if (!file) {
+		std::remove(tmp_path.c_str());
+		return false;
+	}
+	if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+		// Another process was faster
+		std::remove(tmp_path.c_str());
+	}
+	return true;
+}
+
+void MeshData::calcBoundingBox()
+{
+	const double MAX = std::numeric_limits<double>::max();
+	const double MIN = std::numeric_limits<double>::min();
+
+	// Find the center point
+	double max_x = MIN, max_y= MIN, max_z = MIN;
+	double min_x = MAX, min_y = MAX, min_z = MAX;
+	for (auto it = vertices_.begin(); it != vertices_.end(); it++) {
+		const Vec3 vertex = it->cast<double>();
+		max_x = std::max(max_x, vertex.x());
+		max_y = std::max(max_y, vertex.y());
+		max_z = std::max(max_z, vertex.z());
+
+		min_x = std::min(min_x, vertex.x());
+		min_y = std::min(min_y, vertex.y());
+		min_z = std::min(min_z, vertex.z());
+	}
+
+	Vec3 center; 
+	center.x() = (max_x + min_x) / 2;
+	center.y() = (max_y + min_y) / 2;
+	center.z() = (max_z + min_z) / 2;
+
+	Vec3 u{
+		1, 0, 0
+	};
+	Vec3 v{
+		0, 1, 0
+	};
+	Vec3 w{
+		0, 0, 1
+	};
+	double length_u = max_x - center.x();
+	double length_v = max_y - center.y();
+	double length_w = max_z - center.z();
+
+	bounding_box_ = Box3{ center, u, v, w, length_u, length_v, length_w };
+}
+
+bool MeshData::intersectBoundingBox(const Ray & r_local) const
+{
+	return bounding_box_.intersect(r_local);
+}
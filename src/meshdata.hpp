@@ -0,0 +1,159 @@
+#pragma once
+#include <Eigen/Dense>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include "global.hpp"
+#include "camera.hpp"
+#include "box3.hpp"
+#include "arena.hpp"
+#include "ply.hpp"
+#include "mappedfile.hpp"
+
+
+namespace TriangularMesh {
+
+	using Index = int;
+	// Positions are stored with single precision, which is all binary PLY files usually have
+	using Vertex = Eigen::Vector3f;
+	using Vertices = ArrayView<Vertex>;
+	using Face = std::array<Index, 3>;
+	using Faces = ArrayView<Face>;
+	// Unit vector in octahedral encoding, two signed 16 bit coordinates
+	using PackedNormal = uint32_t;
+
+	enum class AsciiError { None, Syntax, NotTriangle };
+
+
+/// @brief Immutable geometry of a triangle mesh in its local coordinates: vertices, faces, normals and bounding box.
+/// It is shared by all TriMesh instances of the same mesh and never changes after loading.
+class MeshData
+{
+public:
+	MeshData(const MeshData&) = delete;
+	MeshData& operator=(const MeshData&) = delete;
+
+	const Vertices& vertices() const;
+	const Faces& faces() const;
+
+	// Position of a vertex in double precision
+	Vec3 vertex(Index i) const;
+
+	// Unit normal of a face, calculated from its vertices
+	Vec3 faceNormal(Index i) const;
+
+	const Box3& boundingBox() const;
+
+	bool interpolateNormals() const;
+
+	// Of vertices, faces and interpolateNormals(), calculated once
+	uint64_t hash() const;
+
+	// Memory of vertices, faces and vertex normals, empty if they are taken from a mesh cache file
+	const Arena::Stats& geometryStats() const;
+
+	// The geometry is used directly from a mapped mesh cache file
+	bool fromCache() const;
+
+	// Number of levels of detail including this mesh as level 0, every further level has about half the faces of the previous one
+	int levelCount() const;
+	const MeshData& level(int i) const;
+
+	// Calculate the intersection point of a ray inside a triangle, uv are the weights of the third and the second vertex
+	bool calcTriIntersect(Index i, const Ray& r_local, double *distance, Vec2 *uv) const;
+	static bool intersectTriangle(const Vec3& A, const Vec3& B, const Vec3& C, const Ray& r, double *distance, Vec2 *uv);
+
+	// Interpolate the normal inside a triangle using Phong interpolation
+	Vec3 calcPhongNormalInterpolation(Index i, double u, double v) const;
+
+	// Check if a local ray intersects the bounding box
+	bool intersectBoundingBox(const Ray& r_local) const;
+
+	// Packing of the vertex normals, unit vectors in and out
+	static PackedNormal encodeNormal(const Vec3& n);
+	static Vec3 decodeNormal(PackedNormal n);
+
+	// Vertex normal as stored
+	PackedNormal vertexNormal(Index i) const;
+
+	static std::shared_ptr<MeshData> createPyramid();
+
+	// Load an ASCII or binary PLY file, coordinates x, y, z and the list vertex_indices are used and all other properties skipped.
+	// The normals of large meshes are calculated with the given number of threads, the result does not depend on it.
+	// With a cache directory the preprocessed geometry is stored there after loading and mapped from there by the next load of the same file with the same options.
+	// With reorder_faces the faces are sorted along a Morton curve of their centroids and the vertices renumbered in the order of their first use,
+	// neighbouring triangles are then close in memory.
+	// Up to lod_levels simplified levels of detail are built after loading, they are stored in the cache directory as well.
+	static std::shared_ptr<MeshData> loadFromPly(const char* path, bool reverse_face_normal, bool interpolate_normals, int threads = 1,
+		const std::string& cache_dir = "", bool reorder_faces = false, int lod_levels = 0);
+
+private:
+	explicit MeshData(bool interpolate_normals);
+
+	// Calculate the normal of a triangle, its length is twice the area
+	Vec3 calcTriNormal(Index i) const;
+
+	// Calculate the normals at all vertices. We need to do this before for Phong interpolation.
+	void calcNormals(int threads);
+
+	// Fill the vertices and faces, already sized to the element counts, from the data following the header of a PLY file.
+	// ASCII files are split into blocks of lines parsed in parallel.
+	bool readPlyAscii(const Ply::Header& header, const Ply::MeshLayout& layout, const uint8_t* data, const uint8_t* end, bool reverse_face_normal, int threads);
+	bool readPlyBinary(const Ply::Header& header, const Ply::MeshLayout& layout, const uint8_t* data, const uint8_t* end, bool reverse_face_normal);
+
+	// Parse the line of item of an element of an ASCII PLY file, items of elements other than vertices and faces are ignored
+	AsciiError parsePlyAsciiLine(const Ply::Element& element, bool vertex, bool face, const Ply::MeshLayout& layout, size_t item, const int* face_order, const char* text, const char* line_end);
+
+	// Sort the faces by the Morton code of their centroid inside the bounding box and renumber the vertices in the order of the sorted faces.
+	// Vertices not used by any face are moved to the end. Needs the bounding box, the normals are calculated afterwards.
+	void reorderFaces(int threads);
+
+	// Copy with about target_faces faces made by collapsing the edges of least quadric error to their midpoints.
+	// Vertices of boundary and non-manifold edges are kept in place and collapses flipping a face are rejected, so fewer faces may be removed.
+	std::unique_ptr<MeshData> simplify(size_t target_faces, int threads) const;
+
+	// Append up to count levels of detail, each simplified from the previous one or mapped from the cache directory
+	void buildLevels(int count, int threads, const std::string& cache_dir, uint64_t key);
+
+	// Allocate vertices, faces and vertex normals of a mesh of the given size in one block
+	void allocateGeometry(size_t vertex_count, size_t face_count);
+
+	// Map the geometry from a cache file written for key, false if it does not exist or is outdated
+	bool loadCache(const std::string& path, uint64_t key);
+
+	// Store the geometry in a cache file, readers never see a partially written file
+	bool writeCache(const std::string& path, uint64_t key) const;
+
+	// Calculate a bounding box which is including all vertices
+	void calcBoundingBox();
+
+	void calcHash();
+
+	/// @brief Start of a mesh cache file, followed by the arrays at the given offsets in the memory layout of this machine
+	struct CacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order; // 0x01020304 as written
+		uint32_t vertex_size, face_size, normal_size;
+		uint64_t key; // of the source file and the load options
+		uint64_t hash; // MeshData::hash()
+		uint64_t vertex_count, face_count;
+		double center[3], lengths[3]; // of the bounding box
+		uint64_t offsets[3]; // vertices, faces, vertex normals
+	};
+
+	// All of the following arrays point into one of them
+	Arena geometry_;
+	MappedFile cache_file_;
+	Vertices vertices_;
+	Faces faces_;
+	ArrayView<PackedNormal> vertex_normals_;
+	Box3 bounding_box_;
+	std::vector<std::unique_ptr<MeshData>> levels_; // simplified levels of detail from 1 on
+	bool interpolate_normals_;
+	uint64_t hash_;
+}; // class MeshData
+
+
+}; // namespace TriangularMesh
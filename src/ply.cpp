@@ -0,0 +1,231 @@
+#include "ply.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+using namespace Ply;
+
+static bool parseType(const std::string& name, Type* type)
+{
+	static const struct { const char* name; Type type; } TYPES[] = {
+		{ "char", Type::Int8 }, { "int8", Type::Int8 },
+		{ "uchar", Type::UInt8 }, { "uint8", Type::UInt8 },
+		{ "short", Type::Int16 }, { "int16", Type::Int16 },
+		{ "ushort", Type::UInt16 }, { "uint16", Type::UInt16 },
+		{ "int", Type::Int32 }, { "int32", Type::Int32 },
+		{ "uint", Type::UInt32 }, { "uint32", Type::UInt32 },
+		{ "float", Type::Float32 }, { "float32", Type::Float32 },
+		{ "double", Type::Float64 }, { "float64", Type::Float64 }
+	};
+	for (auto t = std::begin(TYPES); t != std::end(TYPES); t++) {
+		if (name == t->name) {
+			*type = t->type;
+			return true;
+		}
+	}
+	return false;
+}
+
+int Element::findProperty(const std::string & name) const
+{
+	for (size_t i = 0; i < properties_.size(); i++) {
+		if (properties_[i].name_ == name)
+			return static_cast<int>(i);
+	}
+	return -1;
+}
+
+size_t Element::stride() const
+{
+	size_t stride = 0;
+	for (auto p = properties_.begin(); p != properties_.end(); p++) {
+		if (p->list_)
+			return 0;
+		stride += typeSize(p->type_);
+	}
+	return stride;
+}
+
+size_t Element::minimumStride() const
+{
+	size_t stride = 0;
+	for (auto p = properties_.begin(); p != properties_.end(); p++)
+		stride += typeSize(p->list_ ? p->count_type_ : p->type_);
+	return stride;
+}
+
+bool Header::parse(const uint8_t * data, size_t size)
+{
+	elements_.clear();
+	size_ = 0;
+	const char* text = reinterpret_cast<const char*>(data);
+
+	int line_number = 0;
+	bool has_format = false;
+	while (1) {
+		const char* line_end = static_cast<const char*>(std::memchr(text + size_, '\n', size - size_));
+		if (line_end == nullptr) {
+			std::cout << "Error reading ply-header: missing end_header" << std::endl;
+			return false;
+		}
+		std::string line{ text + size_, line_end };
+		if (!line.empty() && line.back() == '\r')
+			line.erase(line.end() - 1);
+		size_ = line_end - text + 1;
+
+		if (line_number++ == 0) {
+			if (line != "ply")
+				return false;
+			continue;
+		}
+
+		std::istringstream iss{ line };
+		std::string first;
+		if (!(iss >> first)) {
+			std::cout << "Error 1 reading ply-header" << std::endl;
+			return false;
+		}
+		if (first == "format") {
+			std::string format, version;
+			iss >> format >> version;
+			if (format == "ascii")
+				format_ = Format::Ascii;
+			else if (format == "binary_little_endian")
+				format_ = Format::BinaryLittleEndian;
+			else if (format == "binary_big_endian")
+				format_ = Format::BinaryBigEndian;
+			else {
+				std::cout << "Unsupported ply format " << format << std::endl;
+				return false;
+			}
+			if (version != "1.0") {
+				std::cout << "Unsupported ply version " << version << std::endl;
+				return false;
+			}
+			has_format = true;
+		}
+		else if (first == "element") {
+			Element element;
+			long long count;
+			if (!(iss >> element.name_ >> count) || count < 0) {
+				std::cout << "Error reading ply-header: invalid element " << line << std::endl;
+				return false;
+			}
+			element.count_ = static_cast<size_t>(count);
+			elements_.push_back(element);
+		}
+		else if (first == "property") {
+			std::string type;
+			Property property;
+			property.list_ = false;
+			property.count_type_ = Type::UInt8;
+			bool valid = !elements_.empty() && static_cast<bool>(iss >> type);
+			if (valid && type == "list") {
+				property.list_ = true;
+				std::string count_type;
+				valid = iss >> count_type >> type && parseType(count_type, &property.count_type_)
+					&& property.count_type_ != Type::Float32 && property.count_type_ != Type::Float64;
+			}
+			valid = valid && parseType(type, &property.type_) && static_cast<bool>(iss >> property.name_);
+			if (!valid) {
+				std::cout << "Error reading ply-header: invalid property " << line << std::endl;
+				return false;
+			}
+			elements_.back().properties_.push_back(property);
+		}
+		else if (first == "end_header") {
+			break;
+		}
+		// comment and obj_info lines are ignored
+	}
+
+	if (!has_format) {
+		std::cout << "Error reading ply-header: missing format" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int Header::findElement(const std::string & name) const
+{
+	for (size_t i = 0; i < elements_.size(); i++) {
+		if (elements_[i].name_ == name)
+			return static_cast<int>(i);
+	}
+	return -1;
+}
+
+bool Header::swapBytes() const
+{
+	const uint16_t one = 1;
+	bool little_endian = *reinterpret_cast<const uint8_t*>(&one) == 1;
+	return format_ == (little_endian ? Format::BinaryBigEndian : Format::BinaryLittleEndian);
+}
+
+bool MeshLayout::find(const Header & header)
+{
+	vertex_element_ = header.findElement("vertex");
+	face_element_ = header.findElement("face");
+	if (vertex_element_ == -1 || face_element_ == -1) {
+		std::cout << "Error reading ply-header: vertex_count-error:" << (vertex_element_ == -1) << ", face_count-error:" << (face_element_ == -1) << std::endl;
+		return false;
+	}
+
+	const Element& vertex = header.elements_[vertex_element_];
+	x_ = vertex.findProperty("x");
+	y_ = vertex.findProperty("y");
+	z_ = vertex.findProperty("z");
+	if (x_ == -1 || y_ == -1 || z_ == -1 || vertex.properties_[x_].list_ || vertex.properties_[y_].list_ || vertex.properties_[z_].list_) {
+		std::cout << "Error reading ply-header: vertex coordinates x, y, z missing" << std::endl;
+		return false;
+	}
+
+	const Element& face = header.elements_[face_element_];
+	indices_ = face.findProperty("vertex_indices");
+	if (indices_ == -1)
+		indices_ = face.findProperty("vertex_index");
+	if (indices_ == -1 || !face.properties_[indices_].list_ || face.properties_[indices_].type_ == Type::Float32 || face.properties_[indices_].type_ == Type::Float64) {
+		std::cout << "Error reading ply-header: face vertex indices missing" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+size_t Ply::typeSize(Type type)
+{
+	switch (type) {
+	case Type::Int8: case Type::UInt8: return 1;
+	case Type::Int16: case Type::UInt16: return 2;
+	case Type::Int32: case Type::UInt32: case Type::Float32: return 4;
+	case Type::Float64: return 8;
+	}
+	return 0;
+}
+
+template<class T>
+static T load(const uint8_t* data, bool swap_bytes)
+{
+	uint8_t bytes[sizeof(T)];
+	std::memcpy(bytes, data, sizeof(T));
+	if (swap_bytes)
+		std::reverse(bytes, bytes + sizeof(T));
+	T value;
+	std::memcpy(&value, bytes, sizeof(T));
+	return value;
+}
+
+double Ply::readValue(const uint8_t * data, Type type, bool swap_bytes)
+{
+	switch (type) {
+	case Type::Int8: return load<int8_t>(data, false);
+	case Type::UInt8: return load<uint8_t>(data, false);
+	case Type::Int16: return load<int16_t>(data, swap_bytes);
+	case Type::UInt16: return load<uint16_t>(data, swap_bytes);
+	case Type::Int32: return load<int32_t>(data, swap_bytes);
+	case Type::UInt32: return load<uint32_t>(data, swap_bytes);
+	case Type::Float32: return load<float>(data, swap_bytes);
+	case Type::Float64: return load<double>(data, swap_bytes);
+	}
+	return 0;
+}
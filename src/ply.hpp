@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Stanford PLY files: header parser and access to the values of ASCII and binary files
+namespace Ply {
+
+	enum class Format { Ascii, BinaryLittleEndian, BinaryBigEndian };
+
+	enum class Type { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+	struct Property {
+		std::string name_;
+		Type type_; // of the list items for lists
+		bool list_;
+		Type count_type_; // only for lists
+	};
+
+	struct Element {
+		std::string name_;
+		size_t count_;
+		std::vector<Property> properties_;
+
+		// Index of the property or -1
+		int findProperty(const std::string& name) const;
+
+		// Bytes of one item in a binary file, 0 if it has list properties and the size varies
+		size_t stride() const;
+
+		// Bytes of one item in a binary file with all of its lists empty
+		size_t minimumStride() const;
+	};
+
+	struct Header {
+		Format format_;
+		std::vector<Element> elements_;
+		size_t size_; // bytes up to the data, including the end_header line
+
+		// Parse the header at the start of a file, false if it is invalid
+		bool parse(const uint8_t* data, size_t size);
+
+		// Index of the element or -1
+		int findElement(const std::string& name) const;
+
+		// Binary data has to be byte swapped on this machine
+		bool swapBytes() const;
+	};
+
+	/// @brief Where a triangle mesh is stored in a file: coordinates of the vertex element and index list of the face element
+	struct MeshLayout {
+		int vertex_element_;
+		int face_element_;
+		int x_, y_, z_;
+		int indices_;
+
+		// Find the mesh in a parsed header, false if it is missing
+		bool find(const Header& header);
+	};
+
+	size_t typeSize(Type type);
+
+	// Value of type stored at data in a binary file
+	double readValue(const uint8_t* data, Type type, bool swap_bytes);
+
+} // namespace Ply
@@ -2,14 +2,34 @@
 #include <limits>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <thread>
 #include <numeric>
+#include <algorithm>
+#include <chrono>
 
 Raytracer::Raytracer() : 
 	cam_{ SCREEN_WIDTH, SCREEN_HEIGHT, FOCAL_LENGTH },
 	lighting_{ RGBd{1,1,1} * 0.25 }
 {
+	junks_.length_x_ = 50;
+	junks_.length_y_ = 50;
+	junks_.previous_ = nullptr;
+	junks_.record_ = false;
+	history_.valid_ = false;
+	use_visibility_buffer_ = false;
+}
 
+Raytracer::Raytracer(int screen_width, int screen_height, double focal_length) :
+	cam_{ screen_width, screen_height, focal_length },
+	lighting_{ RGBd{1,1,1} * 0.25 }
+{
+	junks_.length_x_ = 50;
+	junks_.length_y_ = 50;
+	junks_.previous_ = nullptr;
+	junks_.record_ = false;
+	history_.valid_ = false;
+	use_visibility_buffer_ = false;
 }
 
 Raytracer::~Raytracer()
@@ -30,28 +50,135 @@ Raytracer::~Raytracer()
 
 void Raytracer::render(RgbImage * image, int threads)
 {
-	for (auto it = objects_.begin(); it != objects_.end(); it++)
-		(*it)->computeScale();
+	ImageSink sink{ image };
+	render(&sink, threads);
+}
 
-	image->resize(cam_.screenWidth(), cam_.screenHeight());
-	junks_.length_x_ = 50;
-	junks_.length_y_ = 50;
+void Raytracer::render(TileSink * sink, int threads)
+{
+	auto start = std::chrono::steady_clock::now();
+	prepareFrame(threads);
+	stats_.prepare_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	initJunks();
+	history_.valid_ = false;
+	renderJunks(sink, threads);
+
+	// Only single frames are summed up, incremental frames keep their stats without printing them.
+	// Formatted separately so the precision of std::cout is left alone.
+	std::ostringstream summary;
+	summary << "Rendered in " << std::setprecision(3) << stats_.render_seconds_ << "s, " << stats_.rays() << " rays, "
+		<< stats_.raysPerSecond() / 1e6 << " Mrays/s";
+	std::cout << summary.str() << std::endl;
+}
 
-	junks_.count_x_ = 1 + (image->width() - 1) / junks_.length_x_;
-	junks_.count_y_ = 1 + (image->height() - 1) / junks_.length_y_;
+void Raytracer::renderIncremental(RgbImage * image, int threads)
+{
+	auto start = std::chrono::steady_clock::now();
+	prepareFrame(threads);
+	stats_.prepare_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	initJunks();
+
+	bool incremental = history_.valid_ && image->width() == junks_.width_ && image->height() == junks_.height_ && findDirtyPixels();
+	if (incremental) {
+		junks_.previous_ = image;
+	}
+	else {
+		junks_.skip_.assign(junks_.total_count_, false);
+		junks_.masks_.clear();
+		history_.primary_.assign(static_cast<size_t>(junks_.width_) * junks_.height_, nullptr);
+		history_.tiles_.assign(junks_.total_count_, ShadingRecord{});
+	}
+	junks_.record_ = true;
+
+	ImageSink sink{ image };
+	renderJunks(&sink, threads);
+
+	// Remember the state of the objects to find the changes of the next frame
+	history_.valid_ = true;
+	history_.view_key_ = viewKey();
+	history_.objects_.assign(objects_.begin(), objects_.end());
+	history_.object_keys_.clear();
+	history_.object_bounds_.clear();
+	for (auto obj = objects_.begin(); obj != objects_.end(); obj++) {
+		history_.object_keys_.push_back((*obj)->hash(0));
+		history_.object_bounds_.push_back((*obj)->worldBounds());
+	}
+	junks_.record_ = false;
+	junks_.previous_ = nullptr;
+}
+
+void Raytracer::prepareFrame(int threads)
+{
+	for (auto it = objects_.begin(); it != objects_.end(); it++) {
+		(*it)->computeScale();
+		(*it)->material().classify();
+		TriangularMesh::TriMesh* mesh = dynamic_cast<TriangularMesh::TriMesh*>(*it);
+		if (mesh) {
+			mesh->selectLevel(cam_);
+			mesh->prepare();
+		}
+	}
+	scene_.build(objects_);
+	lighting_.prepare(scene_, threads);
+	cam_.prepareRays();
+}
+
+void Raytracer::initJunks()
+{
+	// Only the crop window is rendered, the sink receives tiles relative to it
+	junks_.offset_x_ = cam_.cropX();
+	junks_.offset_y_ = cam_.cropY();
+	junks_.width_ = cam_.cropWidth();
+	junks_.height_ = cam_.cropHeight();
+
+	junks_.count_x_ = 1 + (junks_.width_ - 1) / junks_.length_x_;
+	junks_.count_y_ = 1 + (junks_.height_ - 1) / junks_.length_y_;
 	junks_.total_count_ = junks_.count_x_ * junks_.count_y_;
+	if (junks_.width_ <= 0 || junks_.height_ <= 0)
+		junks_.total_count_ = 0;
+	junks_.skip_.assign(junks_.total_count_, false);
+	junks_.masks_.clear();
+	junks_.previous_ = nullptr;
+	junks_.record_ = false;
+}
+
+void Raytracer::renderJunks(TileSink * sink, int threads)
+{
+	if (!sink->begin(junks_.width_, junks_.height_, junks_.length_x_, junks_.length_y_, frameKey())) {
+		std::cout << "Error starting tile output" << std::endl;
+		return;
+	}
+
 	junks_.next_ = 0;
 	junks_.progress_ = 0;
+	for (int i = 0; i < junks_.total_count_; i++) {
+		if (!junks_.skip_[i])
+			junks_.skip_[i] = sink->hasTile((i % junks_.count_x_) * junks_.length_x_, (i / junks_.count_x_) * junks_.length_y_);
+	}
+	binObjects();
+	if (use_visibility_buffer_)
+		visibility_buffer_.prepare(cam_, scene_, junks_.offset_x_, junks_.offset_y_, junks_.width_, junks_.height_, junks_.length_x_, junks_.length_y_);
 
 	threads_.resize(threads);
+	while (scratch_.size() < threads_.size())
+		scratch_.emplace_back(new Arena{ 1024 * 1024 });
+	while (thread_stats_.size() < threads_.size())
+		thread_stats_.emplace_back(new RenderStats{});
+	auto start = std::chrono::steady_clock::now();
 	for (int i = 0; i < threads; i++) {
-		threads_[i] = std::thread(&Raytracer::thread_worker, this, image);
+		thread_stats_[i]->clear(objects_.size(), junks_.total_count_);
+		threads_[i] = std::thread(&Raytracer::thread_worker, this, sink, scratch_[i].get(), thread_stats_[i].get());
 		//raytrace(image, i, threads);
 	}
 
+	// Poll often so that small incremental updates return quickly, but report progress only once a second
+	auto last_report = std::chrono::steady_clock::now();
 	while (junks_.progress_ != junks_.total_count_)
 	{
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		if (std::chrono::steady_clock::now() - last_report < std::chrono::seconds(1))
+			continue;
+		last_report = std::chrono::steady_clock::now();
 		double progress_rel = 100 * junks_.progress_; 
 		progress_rel /= junks_.total_count_;
 		//std::cout << std::setprecision(3) << progress_rel << "%" << std::endl;
@@ -63,6 +190,165 @@ void Raytracer::render(RgbImage * image, int threads)
 	{
 		it->join();
 	}
+
+	stats_.clear(objects_.size(), junks_.total_count_);
+	for (int i = 0; i < threads; i++)
+		stats_.add(*thread_stats_[i]);
+	stats_.threads_ = threads;
+	stats_.render_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (!sink->end())
+		std::cout << "Error finishing tile output" << std::endl;
+}
+
+void Raytracer::binObjects()
+{
+	junks_.candidates_.assign(junks_.total_count_, Scene::Selection{});
+	// Primitives keep their order, so ties between equally distant hits are resolved as before
+	for (int i = 0; i < scene_.sphereCount(); i++)
+		addCandidate(scene_.sphereBounds(i), &Scene::Selection::spheres_, i);
+	for (int i = 0; i < scene_.meshCount(); i++)
+		addCandidate(scene_.mesh(i)->worldBounds(), &Scene::Selection::meshes_, i);
+	for (int i = 0; i < scene_.otherCount(); i++)
+		addCandidate(scene_.other(i)->worldBounds(), &Scene::Selection::others_, i);
+}
+
+void Raytracer::addCandidate(const AABB3 & bounds, std::vector<int> Scene::Selection::* list, int index)
+{
+	int tile_min_x = 0, tile_max_x = junks_.count_x_ - 1;
+	int tile_min_y = 0, tile_max_y = junks_.count_y_ - 1;
+
+	// Primitives reaching behind the camera are candidates everywhere
+	AABB2 pixels;
+	if (cam_.projectBoundsToPixels(bounds, &pixels)) {
+		// Relative to the crop window, one pixel margin for rounding
+		double min_x = pixels.min().x() - 1 - junks_.offset_x_;
+		double max_x = pixels.max().x() + 1 - junks_.offset_x_;
+		double min_y = pixels.min().y() - 1 - junks_.offset_y_;
+		double max_y = pixels.max().y() + 1 - junks_.offset_y_;
+		if (max_x < 0 || max_y < 0 || min_x > junks_.width_ - 1 || min_y > junks_.height_ - 1)
+			return;
+		tile_min_x = static_cast<int>(std::max(0.0, min_x)) / junks_.length_x_;
+		tile_max_x = static_cast<int>(std::min(junks_.width_ - 1.0, max_x)) / junks_.length_x_;
+		tile_min_y = static_cast<int>(std::max(0.0, min_y)) / junks_.length_y_;
+		tile_max_y = static_cast<int>(std::min(junks_.height_ - 1.0, max_y)) / junks_.length_y_;
+	}
+
+	for (int y = tile_min_y; y <= tile_max_y; y++) {
+		for (int x = tile_min_x; x <= tile_max_x; x++)
+			(junks_.candidates_[y * junks_.count_x_ + x].*list).push_back(index);
+	}
+}
+
+bool Raytracer::findDirtyPixels()
+{
+	// Only changes of the objects themselves are tracked, shadow maps depend on all objects
+	if (history_.view_key_ != viewKey() || lighting_.shadowMapsEnabled())
+		return false;
+	if (history_.objects_.size() != objects_.size() || !std::equal(objects_.begin(), objects_.end(), history_.objects_.begin()))
+		return false;
+
+	std::vector<SceneObject_constptr> changed;
+	std::vector<AABB3> changed_bounds;
+	std::vector<AABB2> changed_pixels; // projection of the old and the new bounds
+	for (size_t i = 0; i < objects_.size(); i++) {
+		if (objects_[i]->hash(0) == history_.object_keys_[i])
+			continue;
+		AABB3 bounds = objects_[i]->worldBounds();
+		AABB2 old_pixels, new_pixels;
+		if (!cam_.projectBoundsToPixels(history_.object_bounds_[i], &old_pixels) || !cam_.projectBoundsToPixels(bounds, &new_pixels))
+			return false;
+		changed.push_back(objects_[i]);
+		changed_bounds.push_back(bounds);
+		changed_pixels.push_back(old_pixels);
+		changed_pixels.push_back(new_pixels);
+	}
+
+	junks_.masks_.assign(junks_.total_count_, std::vector<bool>{});
+	for (int i = 0; i < junks_.total_count_; i++) {
+		// Secondary rays of the tile may have hit a changed object or may hit it now
+		const ShadingRecord& deps = history_.tiles_[i];
+		bool whole_tile = false;
+		for (size_t c = 0; c < changed.size() && !whole_tile; c++)
+			whole_tile = deps.dependsOn(changed[c]) || deps.mayBeAffectedBy(changed_bounds[c], lighting_.pointLights());
+		if (whole_tile)
+			continue;
+
+		// Otherwise only the pixels which saw a changed object or may see one now
+		int start_x = (i % junks_.count_x_) * junks_.length_x_;
+		int end_x = std::min(junks_.width_, start_x + junks_.length_x_);
+		int start_y = (i / junks_.count_x_) * junks_.length_y_;
+		int end_y = std::min(junks_.height_, start_y + junks_.length_y_);
+
+		std::vector<bool> mask((end_x - start_x) * (end_y - start_y), false);
+		bool any = false;
+		for (int y = start_y; y < end_y; y++) {
+			for (int x = start_x; x < end_x; x++) {
+				SceneObject_constptr primary = history_.primary_[static_cast<size_t>(y) * junks_.width_ + x];
+				bool dirty = std::find(changed.begin(), changed.end(), primary) != changed.end();
+
+				// One pixel margin for rays not passing through the pixel center
+				Vec2 pixel{ junks_.offset_x_ + x, junks_.offset_y_ + y };
+				for (auto r = changed_pixels.begin(); r != changed_pixels.end() && !dirty; r++)
+					dirty = (pixel.array() >= r->min().array() - 1).all() && (pixel.array() <= r->max().array() + 1).all();
+
+				mask[(y - start_y) * (end_x - start_x) + x - start_x] = dirty;
+				any = any || dirty;
+			}
+		}
+		if (any)
+			junks_.masks_[i].swap(mask);
+		else
+			junks_.skip_[i] = true;
+	}
+	return true;
+}
+
+void Raytracer::setTileSize(int width, int height)
+{
+	junks_.length_x_ = width;
+	junks_.length_y_ = height;
+}
+
+void Raytracer::setVisibilityBuffer(bool enabled)
+{
+	use_visibility_buffer_ = enabled;
+}
+
+const RenderStats & Raytracer::stats() const
+{
+	return stats_;
+}
+
+Arena::Stats Raytracer::scratchStats() const
+{
+	Arena::Stats total{ 0, 0, 0, 0, 0, 0, 0 };
+	for (auto scratch = scratch_.begin(); scratch != scratch_.end(); scratch++) {
+		const Arena::Stats& stats = (*scratch)->stats();
+		total.allocations_ += stats.allocations_;
+		total.bytes_allocated_ += stats.bytes_allocated_;
+		total.bytes_in_use_ += stats.bytes_in_use_;
+		total.bytes_reserved_ += stats.bytes_reserved_;
+		total.blocks_ += stats.blocks_;
+		total.huge_page_blocks_ += stats.huge_page_blocks_;
+		total.resets_ += stats.resets_;
+	}
+	return total;
+}
+
+uint64_t Raytracer::viewKey() const
+{
+	int tile_size[2] = { junks_.length_x_, junks_.length_y_ };
+	uint64_t key = cam_.hash(Util::hash64(tile_size, sizeof(tile_size)));
+	return lighting_.hash(key);
+}
+
+uint64_t Raytracer::frameKey() const
+{
+	uint64_t key = viewKey();
+	for (auto obj = objects_.begin(); obj != objects_.end(); obj++)
+		key = (*obj)->hash(key);
+	return key;
 }
 
 Camera & Raytracer::camera()
@@ -80,65 +366,133 @@ SceneObjects& Raytracer::objects()
 	return objects_;
 }
 
-void Raytracer::thread_worker(RgbImage* image)
+void Raytracer::thread_worker(TileSink* sink, Arena* scratch, RenderStats* stats)
 {
+	// Each thread renders into its own tile buffer and counts into its own stats
+	RgbImage tile{ sink->format() };
+	ShadingRecord record;
+	RenderStats::setCurrent(stats);
+
 	int current_part = reserveNextJunk(-1);
 	while (current_part != -1) {
 		int y_block = current_part / junks_.count_x_;
 		int x_block = current_part - y_block * junks_.count_x_;
 
 		int start_x = x_block*junks_.length_x_;
-		int end_x = std::min(image->width(), start_x + junks_.length_x_);
+		int end_x = std::min(junks_.width_, start_x + junks_.length_x_);
 
 		int start_y = y_block*junks_.length_y_;
-		int end_y = std::min(image->height(), start_y + junks_.length_y_);
+		int end_y = std::min(junks_.height_, start_y + junks_.length_y_);
+
+		if (tile.width() != end_x - start_x || tile.height() != end_y - start_y)
+			tile.resize(end_x - start_x, end_y - start_y);
+
+		const std::vector<bool>* mask = nullptr;
+		if (!junks_.masks_.empty() && !junks_.masks_[current_part].empty()) {
+			mask = &junks_.masks_[current_part];
+			tile.copyRegionFrom(*junks_.previous_, start_x, start_y);
+		}
 
-		raytrace(image, start_x, end_x, start_y, end_y);
+		auto tile_start = std::chrono::steady_clock::now();
+		record.clear();
+		scratch->reset();
+		raytrace(&tile, start_x, end_x, start_y, end_y, junks_.candidates_[current_part], mask, junks_.record_ ? &record : nullptr, scratch);
+		if (junks_.record_) {
+			// Tiles are owned by one thread, no locking needed. Pixels outside of the mask keep their dependencies.
+			record.finish();
+			if (mask)
+				history_.tiles_[current_part].merge(record);
+			else
+				history_.tiles_[current_part] = record;
+		}
+		sink->writeTile(start_x, start_y, tile);
+		stats->tile_seconds_[current_part] = std::chrono::duration<double>(std::chrono::steady_clock::now() - tile_start).count();
 
 		current_part = reserveNextJunk(current_part);
 	}
+	RenderStats::setCurrent(nullptr);
 }
 
-void Raytracer::raytrace(RgbImage* image, int start_x, int end_x, int start_y, int end_y)
+void Raytracer::raytrace(RgbImage* tile, int start_x, int end_x, int start_y, int end_y, const Scene::Selection& candidates, const std::vector<bool>* mask, ShadingRecord* record, Arena* scratch)
 {
 
 	Intersection is_closest{ Vec3::Zero(), Vec3::Zero(), std::numeric_limits<double>().max(), nullptr };
-	assert(start_x >= 0 && end_x <= image->width());
-	assert(start_y >= 0 && end_y <= image->height());
+	assert(start_x >= 0 && end_x <= junks_.width_);
+	assert(start_y >= 0 && end_y <= junks_.height_);
+	assert(tile->width() == end_x - start_x && tile->height() == end_y - start_y);
+
+	// Find the closest hit of every pixel first, then shade all of them at once
+	ArenaVector<Intersection> hits{ scratch };
+	ArenaVector<std::pair<int, int>> hit_pixels{ scratch };
+	hits.reserve((end_x - start_x) * (end_y - start_y));
+	hit_pixels.reserve(hits.capacity());
+
+	ArenaVector<Ray> rays{ scratch };
+	uint64_t primary_rays = 0;
+	cam_.computeRays(junks_.offset_x_ + start_x, junks_.offset_x_ + end_x, junks_.offset_y_ + start_y, junks_.offset_y_ + end_y, &rays);
+	auto r = rays.begin();
+
+	ArenaVector<Intersection> visible{ scratch };
+	if (use_visibility_buffer_) {
+		int tile_index = (start_y / junks_.length_y_) * junks_.count_x_ + start_x / junks_.length_x_;
+		visibility_buffer_.render(tile_index, start_x, end_x, start_y, end_y, rays, candidates, scratch, &visible);
+	}
 
-	for (int pixel_x = start_x; pixel_x < end_x; pixel_x++) {
-		for (int pixel_y = start_y; pixel_y < end_y; pixel_y++) {
+	for (int pixel_y = start_y; pixel_y < end_y; pixel_y++) {
+		for (int pixel_x = start_x; pixel_x < end_x; pixel_x++, r++) {
+			int pixel = (pixel_y - start_y) * (end_x - start_x) + pixel_x - start_x;
+			if (mask && !(*mask)[pixel])
+				continue;
+			primary_rays++;
 			is_closest.distance() = std::numeric_limits<double>().max();
 
-			Ray r = cam_.computeRay(Vec2(pixel_x, pixel_y));
+			if (use_visibility_buffer_) {
+				is_closest = visible[pixel];
+			}
+			else {
+				// Only the closest hit is resolved to a position and normal
+				Hit closest;
+				if (scene_.closestHit(*r, &closest, &candidates))
+					scene_.resolve(*r, closest, &is_closest);
+			}
 
-			for (auto obj = objects_.begin(); obj != objects_.end(); obj++) {
-				Intersection is{ Vec3::Zero(), Vec3::Zero(), 0, nullptr };
+			bool hit = is_closest.distance() < std::numeric_limits<double>().max();
+			if (junks_.record_)
+				history_.primary_[static_cast<size_t>(pixel_y) * junks_.width_ + pixel_x] = hit ? is_closest.obj() : nullptr;
 
-				if ((*obj)->intersect(r, &is)) {
-					if (is.distance() < is_closest.distance()) {
-						is_closest = is;
-					}
-				}
+			if (hit) {
+				hits.push_back(is_closest);
+				hit_pixels.push_back(std::make_pair(pixel_x, pixel_y));
 			}
-
-			Vec3 color{ 0, 0, 0 };
-			if (is_closest.distance() < std::numeric_limits<double>().max()) {
-				color = lighting_.computeColor(is_closest, cam_.transform().translation(), objects_);
+			else {
+				tile->setPixel(pixel_x - start_x, pixel_y - start_y, RGBd::Zero());
 			}
-
-			image->r()(pixel_y, pixel_x) = color[0];
-			image->g()(pixel_y, pixel_x) = color[1];
-			image->b()(pixel_y, pixel_x) = color[2];
 		}
 	}
 
+	RenderStats* stats = RenderStats::current();
+	if (stats)
+		stats->primary_rays_ += primary_rays;
+
+	HitBatch batch;
+	batch.assign(hits, scene_);
+	ArrayX3 colors;
+	const Camera& cam = cam_; // the non-const transform() would invalidate the prepared rays
+	lighting_.computeColors(batch, cam.transform().translation(), scene_, &colors, record);
+
+	for (size_t i = 0; i < hit_pixels.size(); i++) {
+		tile->setPixel(hit_pixels[i].first - start_x, hit_pixels[i].second - start_y, colors.row(i).transpose());
+	}
 }
 
 int Raytracer::reserveNextJunk(int finished_junk)
 {
 	junks_.junk_mutex_.lock();
 	int reserved_junk = -1;
+	while (junks_.next_ != junks_.total_count_ && junks_.skip_[junks_.next_]) {
+		junks_.next_++;
+		junks_.progress_++;
+	}
 	if (junks_.next_ != junks_.total_count_)
 		reserved_junk = junks_.next_++;
 	if (finished_junk != -1)
@@ -146,69 +500,3 @@ int Raytracer::reserveNextJunk(int finished_junk)
 	junks_.junk_mutex_.unlock();
 	return reserved_junk;
 }
-
-
-RgbImage::RgbImage() :
-	width_{ 0 }, height_{ 0 },
-	cv_{height_, width_, CV_64FC3},
-	r_{ reinterpret_cast<double*>(cv_.data)+2,   height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3,3) },
-	g_{ reinterpret_cast<double*>(cv_.data)+1, height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3,3) },
-	b_{ reinterpret_cast<double*>(cv_.data), height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3,3) }
-{
-
-}
-
-RgbImage::RgbImage(int width, int height) : 
-	width_{ width }, height_{ height },
-	cv_{ height_, width_, CV_64FC3 },
-	r_{ reinterpret_cast<double*>(cv_.data)+2,   height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3, 3) },
-	g_{ reinterpret_cast<double*>(cv_.data)+1, height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3, 3) },
-	b_{ reinterpret_cast<double*>(cv_.data), height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3, 3) }
-{
-}
-
-MappedMat & RgbImage::r()
-{
-	return r_;
-}
-
-MappedMat & RgbImage::g()
-{
-	return g_;
-}
-
-MappedMat & RgbImage::b()
-{
-	return b_;
-}
-
-int RgbImage::width()
-{
-	return width_;
-}
-
-int RgbImage::height()
-{
-	return height_;
-}
-
-void RgbImage::resize(int width, int height)
-{
-	width_ = width;
-	height_ = height;
-	cv_ = cv::Mat(height_, width_, CV_64FC3); //a 3 channel double matrix
-
-	// Adapting the maps, cf. to https://eigen.tuxfamily.org/dox/group__TutorialMapClass.html#title3
-	new(&r_) MappedMat{ reinterpret_cast<double*>(cv_.data)+2, height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3,3) };
-	new(&g_) MappedMat{ reinterpret_cast<double*>(cv_.data)+1, height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_ *3,3) };
-	new(&b_) MappedMat{ reinterpret_cast<double*>(cv_.data), height_, width_, Eigen::Stride<Eigen::Dynamic,3>(width_*3,3) };
-	
-	/*Eigen::Map<Matrix4f, RowMajor, Stride<3, 1>> red(cvT.data);
-	Eigen::Map<Matrix4f, RowMajor, Stride<3, 1>> green(cvT.data + 1);
-	Eigen::Map<Matrix4f, RowMajor, Stride<3, 1>> blue(cvT.data + 2);*/
-}
-
-cv::Mat & RgbImage::cv()
-{
-	return cv_;
-}
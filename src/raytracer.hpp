@@ -2,85 +2,127 @@
 
 #include <thread>
 #include <mutex>
-#include <opencv2/core.hpp>
+#include <memory>
 
 #include "global.hpp"
+#include "image.hpp"
 #include "camera.hpp"
 #include "sceneobject.hpp"
 #include "lighting.hpp"
+#include "scene.hpp"
+#include "tilesink.hpp"
+#include "visibilitybuffer.hpp"
+#include "renderstats.hpp"
 
-using MappedMat = Eigen::Map<Eigen::Matrix<double, -1,-1, Eigen::RowMajor>, Eigen::Unaligned, Eigen::Stride<Eigen::Dynamic, 3>>;
-
-class RgbImage
+class Raytracer
 {
-public:
+public:	
+	Raytracer();
+	Raytracer(int screen_width, int screen_height, double focal_length);
+	~Raytracer();
 
+	void render(RgbImage* image, int threads);
 
-	RgbImage();
-	RgbImage(int width, int height);
+	// Render tile by tile into a sink, memory use only depends on the tile size and the number of threads
+	void render(TileSink* sink, int threads);
 
-	MappedMat& r();
-	MappedMat& g();
-	MappedMat& b();
+	// Like render(), but if image still holds the previous frame of renderIncremental() only the pixels
+	// which can have changed are traced again. Objects may change their transform, material or geometry,
+	// any other change of the scene or shadow maps render the whole frame.
+	void renderIncremental(RgbImage* image, int threads);
 
-	int width();
-	int height();
+	// Size of the tiles the image is divided into for rendering, 50x50 by default
+	void setTileSize(int width, int height);
 
-	void resize(int width, int height);
+	// Find the primary hits by rasterising the meshes instead of tracing primary rays, off by default
+	void setVisibilityBuffer(bool enabled);
 
-	cv::Mat& cv();
+	// Allocation counters of the per thread scratch memory of all frames rendered so far, summed over the threads
+	Arena::Stats scratchStats() const;
 
-private:
-	int width_;
-	int height_;
+	// Rays, intersection tests and times of the last frame rendered
+	const RenderStats& stats() const;
 
-	/*
-	Eigen::MatrixXd r_;
-	Eigen::MatrixXd g_;
-	Eigen::MatrixXd b_;
-	*/
+	Camera& camera();
+	Lighting& lighting();
+	SceneObjects& objects();
 
-	cv::Mat cv_;
+private:
+	// Per frame setup of objects, lights and camera
+	void prepareFrame(int threads);
 
-	MappedMat r_;
-	MappedMat g_;
-	MappedMat b_;
-};
+	// Divide the crop window into tiles, none of them is skipped
+	void initJunks();
 
-class Raytracer
-{
-public:	
-	Raytracer();
-	~Raytracer();
+	// Render all tiles which are not skipped into the sink
+	void renderJunks(TileSink* sink, int threads);
 
-	void render(RgbImage* image, int threads);
+	// Collect the primitives whose projected bounds overlap each tile, only they can be hit by its primary rays
+	void binObjects();
 
-	Camera& camera();
-	Lighting& lighting();
-	SceneObjects& objects();
+	// Add a primitive to the candidates of all tiles its bounds project to
+	void addCandidate(const AABB3& bounds, std::vector<int> Scene::Selection::* list, int index);
 
-private:
-	void thread_worker(RgbImage* image);
+	void thread_worker(TileSink* sink, Arena* scratch, RenderStats* stats);
 
-	void raytrace(RgbImage* image, int start_x, int end_x, int start_y, int end_y);
+	// Render the pixels [start_x,end_x) x [start_y,end_y) of the frame into a tile of that size, primary rays are only tested against candidates.
+	// Only pixels set in mask are written if it is given, shading dependencies are added to record if it is given.
+	// Temporary buffers are taken from scratch.
+	void raytrace(RgbImage* tile, int start_x, int end_x, int start_y, int end_y, const Scene::Selection& candidates, const std::vector<bool>* mask, ShadingRecord* record, Arena* scratch);
 
 	int reserveNextJunk(int finished_junk);
 
+	// Select the tiles and pixels affected by the objects changed since the last frame,
+	// false if the whole frame has to be rendered
+	bool findDirtyPixels();
+
+	// Identifies camera, tile size and lighting
+	uint64_t viewKey() const;
+
+	// Identifies everything that influences the pixels of a frame
+	uint64_t frameKey() const;
+
 	struct Junks {
+		int offset_x_, offset_y_; // crop window in the frame
+		int width_, height_;
 		int length_x_, length_y_;
 		int count_x_, count_y_;
 		int total_count_;
 		int next_;
 		int progress_;
+		std::vector<bool> skip_; // already provided by the sink or unchanged
+		std::vector<std::vector<bool>> masks_; // pixels to render of each tile, empty = all
+		std::vector<Scene::Selection> candidates_; // for the primary rays of each tile
+		const RgbImage* previous_; // provides the pixels of a tile outside of its mask
+		bool record_; // fill history_
 		std::mutex junk_mutex_;
 	};
 	Junks junks_;
+
+	bool use_visibility_buffer_;
+	VisibilityBuffer visibility_buffer_;
+
+	/// @brief What the last frame of renderIncremental() depended on
+	struct FrameHistory {
+		bool valid_;
+		uint64_t view_key_;
+		std::vector<SceneObject_constptr> objects_;
+		std::vector<uint64_t> object_keys_;
+		std::vector<AABB3> object_bounds_;
+		std::vector<SceneObject_constptr> primary_; // closest object of each pixel of the crop window, nullptr = background
+		std::vector<ShadingRecord> tiles_;
+	};
+	FrameHistory history_;
 	
 
 	Camera cam_;
 	SceneObjects objects_;
+	Scene scene_; // objects_ sorted by type, rebuilt every frame
 	Lighting lighting_;
 
 	std::vector<std::thread> threads_;	
+	std::vector<std::unique_ptr<Arena>> scratch_; // one per thread, kept from frame to frame and reset for every tile
+	std::vector<std::unique_ptr<RenderStats>> thread_stats_; // one per thread, summed up in stats_ after the frame
+	RenderStats stats_;
 
 };
\ No newline at end of file
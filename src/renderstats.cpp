@@ -0,0 +1,100 @@
+#include "renderstats.hpp"
+#include <fstream>
+#include <sstream>
+
+static thread_local RenderStats* current_stats = nullptr;
+
+RenderStats::RenderStats() :
+	threads_{ 0 }, prepare_seconds_{ 0 }, render_seconds_{ 0 }
+{
+	clear(0, 0);
+}
+
+void RenderStats::clear(size_t object_count, size_t tile_count)
+{
+	primary_rays_ = 0;
+	shadow_rays_ = 0;
+	reflection_rays_ = 0;
+	box_tests_ = 0;
+	triangle_tests_ = 0;
+	sphere_tests_ = 0;
+	hits_ = 0;
+	object_tests_.assign(object_count, 0);
+	tile_seconds_.assign(tile_count, 0);
+}
+
+void RenderStats::add(const RenderStats & other)
+{
+	primary_rays_ += other.primary_rays_;
+	shadow_rays_ += other.shadow_rays_;
+	reflection_rays_ += other.reflection_rays_;
+	box_tests_ += other.box_tests_;
+	triangle_tests_ += other.triangle_tests_;
+	sphere_tests_ += other.sphere_tests_;
+	hits_ += other.hits_;
+	for (size_t i = 0; i < object_tests_.size() && i < other.object_tests_.size(); i++)
+		object_tests_[i] += other.object_tests_[i];
+	// Every tile is rendered by one thread only
+	for (size_t i = 0; i < tile_seconds_.size() && i < other.tile_seconds_.size(); i++)
+		tile_seconds_[i] += other.tile_seconds_[i];
+}
+
+uint64_t RenderStats::rays() const
+{
+	return primary_rays_ + shadow_rays_ + reflection_rays_;
+}
+
+double RenderStats::raysPerSecond() const
+{
+	return render_seconds_ > 0 ? rays() / render_seconds_ : 0;
+}
+
+// Numbers separated by commas
+template<class T>
+static void writeArray(std::ostream& out, const std::vector<T>& values)
+{
+	out << "[";
+	for (size_t i = 0; i < values.size(); i++)
+		out << (i > 0 ? ", " : "") << values[i];
+	out << "]";
+}
+
+std::string RenderStats::toJson() const
+{
+	std::ostringstream out;
+	out.precision(9);
+	out << "{\n";
+	out << "  \"threads\": " << threads_ << ",\n";
+	out << "  \"prepare_seconds\": " << prepare_seconds_ << ",\n";
+	out << "  \"render_seconds\": " << render_seconds_ << ",\n";
+	out << "  \"rays\": { \"primary\": " << primary_rays_ << ", \"shadow\": " << shadow_rays_ << ", \"reflection\": " << reflection_rays_
+		<< ", \"total\": " << rays() << " },\n";
+	out << "  \"rays_per_second\": " << raysPerSecond() << ",\n";
+	out << "  \"tests\": { \"box\": " << box_tests_ << ", \"triangle\": " << triangle_tests_ << ", \"sphere\": " << sphere_tests_ << " },\n";
+	out << "  \"hits\": " << hits_ << ",\n";
+	out << "  \"object_tests\": ";
+	writeArray(out, object_tests_);
+	out << ",\n";
+	out << "  \"tile_seconds\": ";
+	writeArray(out, tile_seconds_);
+	out << "\n}\n";
+	return out.str();
+}
+
+bool RenderStats::writeJson(const std::string & path) const
+{
+	std::ofstream file{ path, std::ios::binary };
+	file << toJson();
+	file.close();
+	return static_cast<bool>(file);
+}
+
+RenderStats * RenderStats::current()
+{
+	return current_stats;
+}
+
+void RenderStats::setCurrent(RenderStats * stats)
+{
+	current_stats = stats;
+}
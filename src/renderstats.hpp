@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// @brief Counters of a rendered frame. Every render thread counts into its own instance, found through current(),
+/// and the renderer sums them up at the end of the frame. Work done outside of the render threads, e.g. building shadow maps, is not counted.
+struct RenderStats
+{
+	uint64_t primary_rays_; // one per rendered pixel, also if the visibility buffer found the hit
+	uint64_t shadow_rays_;
+	uint64_t reflection_rays_;
+	uint64_t box_tests_; // bounding boxes of meshes
+	uint64_t triangle_tests_;
+	uint64_t sphere_tests_;
+	uint64_t hits_; // closest hits found and shadow rays blocked
+	std::vector<uint64_t> object_tests_; // intersection tests of each object in the order of Raytracer::objects()
+	std::vector<double> tile_seconds_; // of each tile of the crop window, 0 for skipped tiles
+	int threads_;
+	double prepare_seconds_; // objects, lights and camera before the tiles
+	double render_seconds_; // all tiles
+
+	RenderStats();
+
+	// Zero all counters for a frame with the given number of objects and tiles
+	void clear(size_t object_count, size_t tile_count);
+
+	// Add the counters of another thread, tiles and objects have to match
+	void add(const RenderStats& other);
+
+	uint64_t rays() const;
+	double raysPerSecond() const;
+
+	std::string toJson() const;
+	bool writeJson(const std::string& path) const;
+
+	// Counters of the calling thread, nullptr outside of the render threads
+	static RenderStats* current();
+	static void setCurrent(RenderStats* stats);
+};
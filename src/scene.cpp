@@ -0,0 +1,266 @@
+#include "scene.hpp"
+#include "renderstats.hpp"
+#include <limits>
+#include <algorithm>
+
+using namespace TriangularMesh;
+
+void Scene::build(const SceneObjects & objects)
+{
+	spheres_ = Spheres{};
+	meshes_.clear();
+	mesh_material_.clear();
+	mesh_slot_.clear();
+	others_.clear();
+	other_material_.clear();
+	other_slot_.clear();
+	materials_.clear();
+	std::vector<uint64_t> material_hashes;
+
+	for (auto obj = objects.begin(); obj != objects.end(); obj++) {
+		int material = addMaterial((*obj)->material(), &material_hashes);
+		int slot = static_cast<int>(obj - objects.begin());
+
+		const Sphere* sphere = dynamic_cast<const Sphere*>(*obj);
+		if (sphere) {
+			// Only rotation, uniform scale and translation keep it a sphere in world coordinates
+			const SE3& tf = sphere->transform();
+			Mat33 linear = tf.matrix().topLeftCorner(3, 3);
+			Mat33 metric = linear.transpose() * linear;
+			double scale = sphere->scale();
+			bool similarity = tf.matrix().row(3).transpose().isApprox(Vec4(0, 0, 0, 1)) && (metric - scale * scale * Mat33::Identity()).norm() < 1e-9 * scale * scale;
+			if (similarity) {
+				Vec3 center = tf.translation();
+				spheres_.center_x_.push_back(center.x());
+				spheres_.center_y_.push_back(center.y());
+				spheres_.center_z_.push_back(center.z());
+				spheres_.radius_.push_back(sphere->radius() * scale);
+				spheres_.scale_.push_back(scale);
+				spheres_.material_.push_back(material);
+				spheres_.obj_.push_back(sphere);
+				spheres_.slot_.push_back(slot);
+				continue;
+			}
+		}
+
+		const TriMesh* mesh = dynamic_cast<const TriMesh*>(*obj);
+		if (mesh) {
+			meshes_.push_back(mesh);
+			mesh_material_.push_back(material);
+			mesh_slot_.push_back(slot);
+			continue;
+		}
+
+		others_.push_back(*obj);
+		other_material_.push_back(material);
+		other_slot_.push_back(slot);
+	}
+}
+
+// Add the intersection tests of the selected primitives to the counters of the object
+static void countTests(RenderStats* stats, const std::vector<int>& slots, const std::vector<int>* selection)
+{
+	size_t count = selection ? selection->size() : slots.size();
+	for (size_t k = 0; k < count; k++) {
+		size_t slot = slots[selection ? (*selection)[k] : k];
+		if (slot < stats->object_tests_.size())
+			stats->object_tests_[slot]++;
+	}
+}
+
+int Scene::addMaterial(const Material & m, std::vector<uint64_t>* hashes)
+{
+	uint64_t hash = m.hash(0);
+	auto it = std::find(hashes->begin(), hashes->end(), hash);
+	if (it != hashes->end())
+		return static_cast<int>(it - hashes->begin());
+	hashes->push_back(hash);
+	materials_.push_back(m);
+	return static_cast<int>(materials_.size()) - 1;
+}
+
+bool Scene::closestHit(const Ray & r, Hit * hit, const Selection * selection) const
+{
+	const double MAX = std::numeric_limits<double>::max();
+	hit->distance_ = MAX;
+
+	// All spheres in one loop over the arrays, the closest one is turned into a hit afterwards
+	const Vec3& o = r.pos();
+	const Vec3& d = r.dir();
+	double a = d.dot(d);
+	int sphere_count = selection ? static_cast<int>(selection->spheres_.size()) : sphereCount();
+	int closest_sphere = -1;
+	for (int k = 0; k < sphere_count; k++) {
+		int i = selection ? selection->spheres_[k] : k;
+		double ox = o.x() - spheres_.center_x_[i];
+		double oy = o.y() - spheres_.center_y_[i];
+		double oz = o.z() - spheres_.center_z_[i];
+		double b = 2.0 * (d.x() * ox + d.y() * oy + d.z() * oz);
+		double c = ox * ox + oy * oy + oz * oz - spheres_.radius_[i] * spheres_.radius_[i];
+
+		double discriminant = b * b - 4.0 * a * c;
+		if (discriminant < 0)
+			continue;
+		double t;
+		if (discriminant == 0) {
+			t = -b / 2.0 / a;
+		}
+		else {
+			double t1 = (-b + std::sqrt(discriminant)) / 2.0 / a;
+			double t2 = (-b - std::sqrt(discriminant)) / 2.0 / a;
+			if (t1 > 0 && t2 > 0)
+				t = std::min(t1, t2);
+			else
+				t = std::max(t1, t2);
+		}
+		if (t > 0 && t < hit->distance_) {
+			hit->distance_ = t;
+			closest_sphere = i;
+		}
+	}
+	if (closest_sphere >= 0) {
+		hit->t_ = hit->distance_ / spheres_.scale_[closest_sphere];
+		hit->obj_ = spheres_.obj_[closest_sphere];
+		hit->primitive_ = 0;
+		hit->u_ = 0;
+		hit->v_ = 0;
+		hit->material_ = spheres_.material_[closest_sphere];
+	}
+
+	RenderStats* stats = RenderStats::current();
+	if (stats) {
+		stats->sphere_tests_ += sphere_count;
+		countTests(stats, spheres_.slot_, selection ? &selection->spheres_ : nullptr);
+		countTests(stats, mesh_slot_, selection ? &selection->meshes_ : nullptr);
+		countTests(stats, other_slot_, selection ? &selection->others_ : nullptr);
+	}
+
+	// Qualified calls, no virtual dispatch for meshes
+	Hit tmp;
+	int mesh_count = selection ? static_cast<int>(selection->meshes_.size()) : meshCount();
+	for (int k = 0; k < mesh_count; k++) {
+		int i = selection ? selection->meshes_[k] : k;
+		if (meshes_[i]->TriMesh::hit(r, &tmp) && tmp.distance_ > 0 && tmp.distance_ < hit->distance_) {
+			*hit = tmp;
+			hit->material_ = mesh_material_[i];
+		}
+	}
+
+	int other_count = selection ? static_cast<int>(selection->others_.size()) : otherCount();
+	for (int k = 0; k < other_count; k++) {
+		int i = selection ? selection->others_[k] : k;
+		if (others_[i]->hit(r, &tmp) && tmp.distance_ > 0 && tmp.distance_ < hit->distance_) {
+			*hit = tmp;
+			hit->material_ = other_material_[i];
+		}
+	}
+	if (stats && hit->distance_ < MAX)
+		stats->hits_++;
+	return hit->distance_ < MAX;
+}
+
+SceneObject_constptr Scene::anyHit(const Ray & r, double max_distance) const
+{
+	// Objects are counted as they are tested, the search stops at the first occluder
+	RenderStats* stats = RenderStats::current();
+	auto blocked = [stats](SceneObject_constptr obj) {
+		if (stats)
+			stats->hits_++;
+		return obj;
+	};
+	auto count = [stats](int slot) {
+		if (stats && slot < static_cast<int>(stats->object_tests_.size()))
+			stats->object_tests_[slot]++;
+	};
+
+	const Vec3& o = r.pos();
+	const Vec3& d = r.dir();
+	double a = d.dot(d);
+	for (int i = 0; i < sphereCount(); i++) {
+		if (stats)
+			stats->sphere_tests_++;
+		count(spheres_.slot_[i]);
+		double ox = o.x() - spheres_.center_x_[i];
+		double oy = o.y() - spheres_.center_y_[i];
+		double oz = o.z() - spheres_.center_z_[i];
+		double b = 2.0 * (d.x() * ox + d.y() * oy + d.z() * oz);
+		double c = ox * ox + oy * oy + oz * oz - spheres_.radius_[i] * spheres_.radius_[i];
+		double discriminant = b * b - 4.0 * a * c;
+		if (discriminant < 0)
+			continue;
+		// The larger root is behind the origin only if the whole sphere is
+		double t_far = (-b + std::sqrt(discriminant)) / 2.0 / a;
+		double t_near = (-b - std::sqrt(discriminant)) / 2.0 / a;
+		double t = t_near > 0 ? t_near : t_far;
+		if (t >= 0 && t < max_distance)
+			return blocked(spheres_.obj_[i]);
+	}
+
+	Hit tmp;
+	for (size_t i = 0; i < meshes_.size(); i++) {
+		count(mesh_slot_[i]);
+		if (meshes_[i]->TriMesh::hit(r, &tmp) && tmp.distance_ < max_distance)
+			return blocked(meshes_[i]);
+	}
+	for (size_t i = 0; i < others_.size(); i++) {
+		count(other_slot_[i]);
+		if (others_[i]->hit(r, &tmp) && tmp.distance_ < max_distance)
+			return blocked(others_[i]);
+	}
+	return nullptr;
+}
+
+void Scene::resolve(const Ray & r, const Hit & hit, Intersection * is) const
+{
+	hit.obj_->resolve(r, hit, is);
+	is->materialId() = hit.material_;
+}
+
+const Material & Scene::material(const Intersection & is) const
+{
+	if (is.materialId() >= 0)
+		return materials_[is.materialId()];
+	return is.obj()->material();
+}
+
+const std::vector<Material>& Scene::materials() const
+{
+	return materials_;
+}
+
+int Scene::sphereCount() const
+{
+	return static_cast<int>(spheres_.obj_.size());
+}
+
+AABB3 Scene::sphereBounds(int i) const
+{
+	Vec3 center{ spheres_.center_x_[i], spheres_.center_y_[i], spheres_.center_z_[i] };
+	Vec3 extent = Vec3::Constant(spheres_.radius_[i]);
+	return AABB3{ center - extent, center + extent };
+}
+
+int Scene::meshCount() const
+{
+	return static_cast<int>(meshes_.size());
+}
+
+const TriMesh * Scene::mesh(int i) const
+{
+	return meshes_[i];
+}
+
+int Scene::meshMaterial(int i) const
+{
+	return mesh_material_[i];
+}
+
+int Scene::otherCount() const
+{
+	return static_cast<int>(others_.size());
+}
+
+SceneObject_constptr Scene::other(int i) const
+{
+	return others_[i];
+}
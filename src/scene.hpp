@@ -0,0 +1,70 @@
+#pragma once
+#include "global.hpp"
+#include "sceneobject.hpp"
+#include "trimesh.hpp"
+#include <vector>
+
+/// @brief Render time copy of the scene objects stored by primitive type.
+/// Spheres are kept as structure of arrays in world coordinates and tested in one loop, meshes are called without virtual dispatch,
+/// only other kinds of objects go through SceneObject::hit(). Materials are shared in a table and referenced by id.
+class Scene
+{
+public:
+	/// @brief Subset of the primitives, e.g. the candidates for the primary rays of a tile. Indices in the order of the objects.
+	struct Selection {
+		std::vector<int> spheres_;
+		std::vector<int> meshes_;
+		std::vector<int> others_;
+	};
+
+	// Sort the objects by type, called once per frame after SceneObject::computeScale()
+	void build(const SceneObjects& objects);
+
+	// Closest hit in front of the ray origin with all primitives or only the selected ones, hit->material_ is set
+	bool closestHit(const Ray& r, Hit* hit, const Selection* selection = nullptr) const;
+
+	// Some object hit closer than max_distance or nullptr, used for shadow rays
+	SceneObject_constptr anyHit(const Ray& r, double max_distance) const;
+
+	// Position, normal and material id of a hit found by closestHit()
+	void resolve(const Ray& r, const Hit& hit, Intersection* is) const;
+
+	// Material of an intersection, taken from the table if its id is set
+	const Material& material(const Intersection& is) const;
+	const std::vector<Material>& materials() const;
+
+	int sphereCount() const;
+	AABB3 sphereBounds(int i) const;
+
+	int meshCount() const;
+	const TriangularMesh::TriMesh* mesh(int i) const;
+	int meshMaterial(int i) const;
+
+	int otherCount() const;
+	SceneObject_constptr other(int i) const;
+
+private:
+	// Material id of the object, materials with the same hash share an entry
+	int addMaterial(const Material& m, std::vector<uint64_t>* hashes);
+
+	struct Spheres {
+		std::vector<double> center_x_, center_y_, center_z_;
+		std::vector<double> radius_;
+		std::vector<double> scale_; // world to object units, to fill Hit::t_
+		std::vector<int> material_;
+		std::vector<SceneObject_constptr> obj_;
+		std::vector<int> slot_; // index in the objects, for RenderStats::object_tests_
+	};
+	Spheres spheres_;
+
+	std::vector<const TriangularMesh::TriMesh*> meshes_;
+	std::vector<int> mesh_material_;
+	std::vector<int> mesh_slot_;
+
+	// Everything else, including spheres with a non-uniform scale
+	std::vector<SceneObject_constptr> others_;
+	std::vector<int> other_material_;
+	std::vector<int> other_slot_;
+
+	std::vector<Material> materials_;
+};
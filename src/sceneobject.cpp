@@ -1,7 +1,7 @@
 #include "sceneobject.hpp"
 #include <iostream>
 Intersection::Intersection(const Vec3& pos, const Vec3& normal, double distance, SceneObject_constptr obj) :
-	pos_{ pos }, normal_{ normal }, distance_to_origin_{ distance }, obj_{obj_}
+	pos_{ pos }, normal_{ normal }, distance_to_origin_{ distance }, obj_{obj_}, material_id_{ -1 }
 {
 
 }
@@ -46,6 +46,16 @@ SceneObject_constptr & Intersection::obj()
 	return obj_;
 }
 
+int & Intersection::materialId()
+{
+	return material_id_;
+}
+
+int Intersection::materialId() const
+{
+	return material_id_;
+}
+
 Sphere::Sphere(SE3 tf, Material m, double radius) :
 	SceneObject(tf, m),
 	radius_{ radius }
@@ -57,7 +67,7 @@ Sphere::~Sphere()
 {
 }
 
-bool Sphere::intersect(const Ray& r, Intersection* is) const
+bool Sphere::hit(const Ray& r, Hit* hit) const
 {
 	Ray r_local = transformToLocalRay(r);
 	Vec3 sphere2ray = r_local.pos();
@@ -85,14 +95,41 @@ bool Sphere::intersect(const Ray& r, Intersection* is) const
 	if (t < 0)
 		return false;
 
+	hit->distance_ = scale() * t;
+	hit->t_ = t;
+	hit->obj_ = this;
+	hit->primitive_ = 0;
+	hit->u_ = 0;
+	hit->v_ = 0;
+	hit->material_ = -1;
+	return true;
+}
+
+void Sphere::resolve(const Ray & r, const Hit & hit, Intersection * is) const
+{
+	Ray r_local = transformToLocalRay(r);
 	is->obj() = this;
-	is->pos() = (tf_ * (r_local.pos() + t * r_local.dir()).homogeneous()).topRows(3);
-	is->distance() = scale() * t;
+	is->pos() = (tf_ * (r_local.pos() + hit.t_ * r_local.dir()).homogeneous()).topRows(3);
+	is->distance() = hit.distance_;
 	is->normal() = (is->pos() - tf_.translation()).normalized();
-	return true;
 }
 
 
+uint64_t Sphere::hash(uint64_t seed) const
+{
+	return Util::hash64(&radius_, sizeof(radius_), SceneObject::hash(seed));
+}
+
+double Sphere::radius() const
+{
+	return radius_;
+}
+
+Box3 Sphere::localBounds() const
+{
+	return Box3{ Vec3::Zero(), Vec3::UnitX(), Vec3::UnitY(), Vec3::UnitZ(), radius_, radius_, radius_ };
+}
+
 
 SceneObject::SceneObject(SE3 tf, Material m) :
 	tf_(tf), material_(m), scale_cached_(0)
@@ -104,6 +141,31 @@ SceneObject::~SceneObject()
 {
 }
 
+bool SceneObject::intersect(const Ray & r, Intersection * is) const
+{
+	Hit h;
+	if (!hit(r, &h))
+		return false;
+	resolve(r, h, is);
+	is->materialId() = h.material_;
+	return true;
+}
+
+uint64_t SceneObject::hash(uint64_t seed) const
+{
+	seed = Util::hash64(tf_.data(), sizeof(double) * 16, seed);
+	return material_.hash(seed);
+}
+
+AABB3 SceneObject::worldBounds() const
+{
+	AABB3 bounds;
+	std::vector<Vec3> corners = localBounds().corners();
+	for (auto c = corners.begin(); c != corners.end(); c++)
+		bounds.extend(Vec3{ (tf_ * c->homogeneous()).topRows(3) });
+	return bounds;
+}
+
 SE3 & SceneObject::transform()
 {
 	scale_cached_ = 0;
@@ -4,6 +4,7 @@
 #include "global.hpp"
 #include "camera.hpp"
 #include "material.hpp"
+#include "box3.hpp"
 
 class SceneObject;
 
@@ -28,11 +29,28 @@ public:
 	SceneObject_constptr obj() const;
 	SceneObject_constptr& obj();
 
+	// Index into the material table of the Scene, -1 if the material of obj() is used
+	int& materialId();
+	int materialId() const;
+
 private:
 	Vec3 pos_;
 	Vec3 normal_;
 	double distance_to_origin_;
 	SceneObject_constptr obj_;
+	int material_id_;
+};
+
+
+/// @brief Compact record of a ray hit. Position and normal are only computed by SceneObject::resolve() for the closest hit.
+struct Hit
+{
+	double distance_; // along the ray in world units
+	double t_; // ray parameter in object coordinates
+	SceneObject_constptr obj_;
+	int primitive_; // face of a mesh
+	double u_, v_; // barycentric coordinates inside the face
+	int material_; // set by Scene
 };
 
 
@@ -43,7 +61,23 @@ public:
 
 	virtual ~SceneObject();
 
-	virtual bool intersect(const Ray& r, Intersection *is) const = 0;
+	// Closest hit of a ray in front of its origin, only the compact record is filled
+	virtual bool hit(const Ray& r, Hit* hit) const = 0;
+
+	// Position and normal of a hit of this object found by hit() with the same ray
+	virtual void resolve(const Ray& r, const Hit& hit, Intersection* is) const = 0;
+
+	// hit() and resolve() in one go
+	bool intersect(const Ray& r, Intersection *is) const;
+
+	// Hash of transform, material and geometry, used to detect changes of a scene
+	virtual uint64_t hash(uint64_t seed) const;
+
+	// Bounding box in object coordinates
+	virtual Box3 localBounds() const = 0;
+
+	// Axis aligned box in world coordinates containing the object
+	AABB3 worldBounds() const;
 
 	SE3& transform();
 	const SE3& transform() const;	
@@ -73,7 +107,14 @@ public:
 
 	virtual ~Sphere();
 
-	virtual bool intersect(const Ray& r, Intersection *is) const;
+	virtual bool hit(const Ray& r, Hit* hit) const;
+	virtual void resolve(const Ray& r, const Hit& hit, Intersection* is) const;
+
+	virtual uint64_t hash(uint64_t seed) const;
+
+	virtual Box3 localBounds() const;
+
+	double radius() const;
 
 private:
 	double radius_;
@@ -0,0 +1,108 @@
+#include "shadowmap.hpp"
+#include <thread>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+ShadowCubeMap::ShadowCubeMap(int resolution) :
+	resolution_{ resolution }, light_pos_{ Vec3::Zero() },
+	depth_(6 * resolution * resolution, std::numeric_limits<float>::infinity())
+{
+}
+
+void ShadowCubeMap::build(const Vec3 & light_pos, const Scene & scene, int threads)
+{
+	light_pos_ = light_pos;
+	int rows = 6 * resolution_;
+	threads = std::max(1, std::min(threads, rows));
+
+	std::vector<std::thread> workers;
+	for (int i = 1; i < threads; i++) {
+		workers.push_back(std::thread(&ShadowCubeMap::buildRows, this, std::cref(scene), i * rows / threads, (i + 1) * rows / threads));
+	}
+	buildRows(scene, 0, rows / threads);
+	for (auto it = workers.begin(); it != workers.end(); it++)
+		it->join();
+}
+
+void ShadowCubeMap::buildRows(const Scene & scene, int start_row, int end_row)
+{
+	for (int row = start_row; row < end_row; row++) {
+		int face = row / resolution_;
+		int v = row - face * resolution_;
+		for (int u = 0; u < resolution_; u++) {
+			Ray r{ light_pos_, texelToDirection(face, u, v) };
+
+			double closest = std::numeric_limits<double>::infinity();
+			Hit hit;
+			if (scene.closestHit(r, &hit))
+				closest = hit.distance_;
+			depth(face, u, v) = static_cast<float>(closest);
+		}
+	}
+}
+
+double ShadowCubeMap::visibility(const Vec3 & point, double cos_light, double bias, int pcf_radius) const
+{
+	Vec3 light2point = point - light_pos_;
+	double distance = light2point.norm();
+
+	// A texel covers roughly 2/resolution radians, on a tilted surface the depth varies by tan(angle) over it
+	double tan_light = std::sqrt(std::max(0.0, 1 - cos_light * cos_light)) / std::max(cos_light, 0.1);
+	bias += distance * 2.0 / resolution_ * (1 + pcf_radius) * tan_light;
+
+	int face, u, v;
+	directionToTexel(light2point, &face, &u, &v);
+
+	int lit = 0, total = 0;
+	for (int dv = -pcf_radius; dv <= pcf_radius; dv++) {
+		for (int du = -pcf_radius; du <= pcf_radius; du++) {
+			// Samples are clamped to the face, filtering across cube edges is not worth it for previews
+			int su = std::min(std::max(u + du, 0), resolution_ - 1);
+			int sv = std::min(std::max(v + dv, 0), resolution_ - 1);
+			if (distance <= depth(face, su, sv) + bias)
+				lit++;
+			total++;
+		}
+	}
+	return static_cast<double>(lit) / total;
+}
+
+int ShadowCubeMap::resolution() const
+{
+	return resolution_;
+}
+
+void ShadowCubeMap::directionToTexel(const Vec3 & dir, int * face, int * u, int * v) const
+{
+	int axis;
+	dir.cwiseAbs().maxCoeff(&axis);
+	double major = std::abs(dir[axis]);
+	*face = 2 * axis + (dir[axis] < 0 ? 1 : 0);
+
+	// The two remaining axes span the face, mapped from [-1,1] to [0,resolution)
+	double fu = dir[(axis + 1) % 3] / major;
+	double fv = dir[(axis + 2) % 3] / major;
+	*u = std::min(std::max(static_cast<int>((fu + 1) / 2 * resolution_), 0), resolution_ - 1);
+	*v = std::min(std::max(static_cast<int>((fv + 1) / 2 * resolution_), 0), resolution_ - 1);
+}
+
+Vec3 ShadowCubeMap::texelToDirection(int face, int u, int v) const
+{
+	int axis = face / 2;
+	Vec3 dir;
+	dir[axis] = (face % 2 == 0) ? 1 : -1;
+	dir[(axis + 1) % 3] = (u + 0.5) / resolution_ * 2 - 1;
+	dir[(axis + 2) % 3] = (v + 0.5) / resolution_ * 2 - 1;
+	return dir.normalized();
+}
+
+float & ShadowCubeMap::depth(int face, int u, int v)
+{
+	return depth_[(face * resolution_ + v) * resolution_ + u];
+}
+
+float ShadowCubeMap::depth(int face, int u, int v) const
+{
+	return depth_[(face * resolution_ + v) * resolution_ + u];
+}
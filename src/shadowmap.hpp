@@ -0,0 +1,38 @@
+#pragma once
+#include "global.hpp"
+#include "scene.hpp"
+#include <vector>
+
+/// @brief Depth cube map around a point light used for approximate shadows.
+/// Each texel stores the distance from the light to the closest surface in the direction of the texel center.
+class ShadowCubeMap
+{
+public:
+	ShadowCubeMap(int resolution);
+
+	// Cast one ray per texel from the light position into the scene. The rows are split across the given number of threads.
+	void build(const Vec3& light_pos, const Scene& scene, int threads);
+
+	// Fraction of the (2*pcf_radius+1)^2 texels around the direction to the point which see the point, 0 = full shadow, 1 = lit.
+	// cos_light is the cosine between surface normal and light direction, it scales the bias up at grazing angles.
+	double visibility(const Vec3& point, double cos_light, double bias, int pcf_radius) const;
+
+	int resolution() const;
+
+private:
+	// Face index and texel coordinates for a direction, faces are ordered +X, -X, +Y, -Y, +Z, -Z
+	void directionToTexel(const Vec3& dir, int* face, int* u, int* v) const;
+
+	// Direction through the center of a texel
+	Vec3 texelToDirection(int face, int u, int v) const;
+
+	// Fill the rows [start_row, end_row) of all six faces stacked on top of each other
+	void buildRows(const Scene& scene, int start_row, int end_row);
+
+	float& depth(int face, int u, int v);
+	float depth(int face, int u, int v) const;
+
+	int resolution_;
+	Vec3 light_pos_;
+	std::vector<float> depth_;
+};
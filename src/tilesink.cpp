@@ -0,0 +1,112 @@
+#include "tilesink.hpp"
+#include "imagewriter.hpp"
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+TileSink::TileSink(PixelFormat format) :
+	format_{ format }
+{
+}
+
+TileSink::~TileSink()
+{
+}
+
+bool TileSink::begin(int /*width*/, int /*height*/, int /*tile_width*/, int /*tile_height*/, uint64_t /*frame_key*/)
+{
+	return true;
+}
+
+bool TileSink::end()
+{
+	return true;
+}
+
+bool TileSink::hasTile(int /*x*/, int /*y*/) const
+{
+	return false;
+}
+
+PixelFormat TileSink::format() const
+{
+	return format_;
+}
+
+
+ImageSink::ImageSink(RgbImage * image) :
+	TileSink{ image->format() }, image_{ image }
+{
+}
+
+bool ImageSink::begin(int width, int height, int /*tile_width*/, int /*tile_height*/, uint64_t /*frame_key*/)
+{
+	// Keep the pixels of a previous frame of the same size, incremental rendering only writes the changed tiles
+	if (image_->width() != width || image_->height() != height)
+		image_->resize(width, height);
+	return true;
+}
+
+void ImageSink::writeTile(int x, int y, const RgbImage & tile)
+{
+	// Tiles do not overlap, no locking needed
+	image_->copyFrom(tile, x, y);
+}
+
+
+TileDirectorySink::TileDirectorySink(const std::string & directory, const std::string & extension, PixelFormat format) :
+	TileSink{ format }, directory_{ directory }, extension_{ extension }
+{
+}
+
+bool TileDirectorySink::begin(int width, int height, int tile_width, int tile_height, uint64_t /*frame_key*/)
+{
+	// The directory may already exist
+#ifdef _WIN32
+	_mkdir(directory_.c_str());
+#else
+	mkdir(directory_.c_str(), 0755);
+#endif
+
+	index_.open(directory_ + "/index.txt");
+	if (!index_) {
+		std::cout << "Error creating tile index in " << directory_ << std::endl;
+		return false;
+	}
+	index_ << width << " " << height << " " << tile_width << " " << tile_height << std::endl;
+	return true;
+}
+
+void TileDirectorySink::writeTile(int x, int y, const RgbImage & tile)
+{
+	std::ostringstream filename;
+	filename << "tile_" << x << "_" << y << extension_;
+	if (!writeImage(directory_ + "/" + filename.str(), tile))
+		return;
+
+	// Tiles appear in the index only after their file is complete
+	std::lock_guard<std::mutex> lock(index_mutex_);
+	index_ << x << " " << y << " " << tile.width() << " " << tile.height() << " " << filename.str() << std::endl;
+}
+
+bool TileDirectorySink::end()
+{
+	index_.close();
+	return !index_.fail();
+}
+
+
+CallbackSink::CallbackSink(PixelFormat format, Callback callback) :
+	TileSink{ format }, callback_{ callback }
+{
+}
+
+void CallbackSink::writeTile(int x, int y, const RgbImage & tile)
+{
+	callback_(x, y, tile);
+}
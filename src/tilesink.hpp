@@ -0,0 +1,82 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <mutex>
+#include <functional>
+#include "image.hpp"
+
+/// @brief Receives the finished tiles of a render.
+/// Only the tiles in flight are kept in memory, so a sink which does not hold the whole frame allows arbitrary image sizes.
+class TileSink
+{
+public:
+	TileSink(PixelFormat format);
+	virtual ~TileSink();
+
+	// Called once before rendering starts. frame_key identifies the scene, camera and tiling,
+	// sinks which keep state across runs use it to detect that the frame changed.
+	virtual bool begin(int width, int height, int tile_width, int tile_height, uint64_t frame_key);
+
+	// Called by the render threads as soon as a tile is finished, implementations have to be thread safe.
+	// x and y are the position of the top-left pixel of the tile in the frame.
+	virtual void writeTile(int x, int y, const RgbImage& tile) = 0;
+
+	// Called once after all tiles have been written
+	virtual bool end();
+
+	// True if the sink already holds the tile at (x,y) from an earlier run, the renderer skips those tiles
+	virtual bool hasTile(int x, int y) const;
+
+	// Pixel format of the tiles passed to writeTile()
+	PixelFormat format() const;
+
+protected:
+	PixelFormat format_;
+};
+
+/// @brief Assembles the tiles in an image in memory
+class ImageSink : public TileSink
+{
+public:
+	ImageSink(RgbImage* image);
+
+	virtual bool begin(int width, int height, int tile_width, int tile_height, uint64_t frame_key);
+	virtual void writeTile(int x, int y, const RgbImage& tile);
+
+private:
+	RgbImage* image_;
+};
+
+/// @brief Writes every tile to its own file in a directory.
+/// The file index.txt lists the frame size in its first line and then one line "x y width height filename" per finished tile.
+class TileDirectorySink : public TileSink
+{
+public:
+	// extension selects the ImageWriter for the tiles, e.g. ".png"
+	TileDirectorySink(const std::string& directory, const std::string& extension, PixelFormat format);
+
+	virtual bool begin(int width, int height, int tile_width, int tile_height, uint64_t frame_key);
+	virtual void writeTile(int x, int y, const RgbImage& tile);
+	virtual bool end();
+
+private:
+	std::string directory_;
+	std::string extension_;
+	std::ofstream index_;
+	std::mutex index_mutex_;
+};
+
+/// @brief Passes the tiles to a function, e.g. to send them over the network
+class CallbackSink : public TileSink
+{
+public:
+	using Callback = std::function<void(int x, int y, const RgbImage& tile)>;
+
+	// The callback is called from the render threads
+	CallbackSink(PixelFormat format, Callback callback);
+
+	virtual void writeTile(int x, int y, const RgbImage& tile);
+
+private:
+	Callback callback_;
+};
@@ -1,42 +1,71 @@
 #include "trimesh.hpp"
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <string>
+#include "renderstats.hpp"
+#include <limits>
+#include <algorithm>
 
 using namespace TriangularMesh;
 
-TriMesh::TriMesh(const SE3 & tf, const Material & m, bool interpolate_normals):
-	SceneObject{tf, m}, bounding_box_{Vec3::Zero(), Vec3::Zero(), Vec3::Zero(), Vec3::Zero(), 0, 0, 0 }, interpolate_normals_{interpolate_normals}
+TriMesh::TriMesh(const SE3 & tf, const Material & m, std::shared_ptr<const MeshData> data):
+	SceneObject{tf, m}, data_{data}, level_{ 0 }, level_data_{ data_.get() }, static_set_{ false }, static_{ true }, baked_{ false }, baked_key_{ 0 },
+	world_box_{ Vec3::Zero(), Vec3::UnitX(), Vec3::UnitY(), Vec3::UnitZ(), 0, 0, 0 }, orientation_{ 1 }
 {
-
+	tf_.translate(-data_->boundingBox().center());
+	updateInverse();
 }
 
 TriMesh::~TriMesh()
 {
 }
 
-bool TriMesh::intersect(const Ray & r, Intersection * is) const
+bool TriMesh::hit(const Ray & r, Hit * hit) const
 {	
-	Ray r_local{
-		(tf_.inverse() * r.pos().homogeneous()).topRows(3),
-		(tf_.rotation().transpose() * r.dir()) // tf may have a scale component. We need to normalize the direction.
-	};
-
-	if (!intersectBoundingBox(r_local)) {
-		return false;
-	}
-
-	// Find the closest triangle that is intersecting with the ray
-	Index tri_closest = -1; double tri_closest_distance = std::numeric_limits<double>::max(); Vec3 tri_closest_point;
-	for (int i = 0; i < faces_.size(); i++) {
-		Vec3 point_tmp; double distance_tmp;
-		if (calcTriIntersect(i, r_local, &point_tmp, &distance_tmp)) {
-			if (distance_tmp < tri_closest_distance && distance_tmp > 0) {
-				// Found a intersection with positive depth
+	const MeshData& data = *level_data_;
+	const Faces& faces = data.faces();
+	const int face_count = static_cast<int>(faces.size());
+	Index tri_closest = -1; double tri_closest_distance = std::numeric_limits<double>::max(); Vec2 tri_closest_uv;
+	RenderStats* stats = RenderStats::current();
+	if (stats)
+		stats->box_tests_++;
+
+	if (baked_) {
+		// World rays, no transform at all
+		if (!world_box_.intersect(r))
+			return false;
+		if (stats)
+			stats->triangle_tests_ += faces.size();
+		for (int i = 0; i < face_count; i++) {
+			Vec2 uv_tmp; double distance_tmp;
+			const Face& f = faces[i];
+			if (MeshData::intersectTriangle(world_vertices_[f[0]].cast<double>(), world_vertices_[f[1]].cast<double>(), world_vertices_[f[2]].cast<double>(),
+				r, &distance_tmp, &uv_tmp) && distance_tmp < tri_closest_distance && distance_tmp > 0) {
 				tri_closest = i;
 				tri_closest_distance = distance_tmp;
-				tri_closest_point = point_tmp;
+				tri_closest_uv = uv_tmp;
+			}
+		}
+	}
+	else {
+		// The direction is not normalized, so distances along the local ray are distances along the world ray for any scale
+		Ray r_local{
+			(world2local_ * r.pos().homogeneous()).topRows(3),
+			world2local_.linear() * r.dir()
+		};
+		if (!data.intersectBoundingBox(r_local)) {
+			return false;
+		}
+		if (stats)
+			stats->triangle_tests_ += faces.size();
+
+		// Find the closest triangle that is intersecting with the ray
+		for (int i = 0; i < face_count; i++) {
+			Vec2 uv_tmp; double distance_tmp;
+			if (data.calcTriIntersect(i, r_local, &distance_tmp, &uv_tmp)) {
+				if (distance_tmp < tri_closest_distance && distance_tmp > 0) {
+					// Found a intersection with positive depth
+					tri_closest = i;
+					tri_closest_distance = distance_tmp;
+					tri_closest_uv = uv_tmp;
+				}
 			}
 		}
 	}
@@ -45,292 +74,204 @@ bool TriMesh::intersect(const Ray & r, Intersection * is) const
 		return false;
 	}	
 
-	// Calculate the interpolated normal at that point
-	Vec3 normal;
-	if(interpolate_normals_)
-		normal = calcPhongNormalInterpolation(tri_closest, tri_closest_point);
-	else
-		normal = face_normals_unit_[tri_closest];
-
-	// Transform back to world coordinate frame
-	is->pos() = (tf_ * tri_closest_point.homogeneous()).topRows(3);
-	is->distance() = scale() * tri_closest_distance; // Don't forget to apply Scaling.
-	is->obj() = this;
-	is->normal() = tf_.rotation() * normal; // Normalize direction.
+	hit->distance_ = tri_closest_distance;
+	hit->t_ = tri_closest_distance;
+	hit->obj_ = this;
+	hit->primitive_ = tri_closest;
+	hit->u_ = tri_closest_uv[0];
+	hit->v_ = tri_closest_uv[1];
+	hit->material_ = -1;
 	return true;
 }
 
-
-TriMesh* TriMesh::createPyramid(const SE3 & tf, const Material & m)
-{
-	TriMesh* obj = new TriMesh{ tf, m, false };
-	obj->vertices_.push_back(Vertex{ 0,0,0 });
-	obj->vertices_.push_back(Vertex{ 1,0,0 });
-	obj->vertices_.push_back(Vertex{ 0,1,0 });
-	obj->vertices_.push_back(Vertex{ 0,0,1 });
-	obj->faces_.push_back(Face{0, 1, 2});
-	obj->faces_.push_back(Face{0, 3, 1});
-	obj->faces_.push_back(Face{0, 2, 3});
-	obj->faces_.push_back(Face{1, 3, 2});
-	obj->calcNormals();
-	obj->calcBoundingBox();
-	obj->tf_.translate(-obj->bounding_box_.center());
-	return obj;	
-}
-
-void getline(std::ifstream& file, std::string& line)
+bool TriMesh::hitFace(Index face, const Ray & r, Hit * hit) const
 {
-    std::getline(file, line, '\n');
-    if(line.back() == '\r')
-        line.erase(line.end()-1);
-}
-
-TriMesh * TriMesh::loadFromPly(const char * path, bool reverse_face_normal, const SE3& tf, const Material& m, bool interpolate_normals)
-{
-	std::ifstream file{ path };
-	std::string line;
-
-	// Read Ply header
-    getline(file, line);
-    if (line != "ply")
-		return nullptr;
-
-    getline(file, line);
-    if (line != "format ascii 1.0")
-		return nullptr;
-	size_t vertex_count = -1, face_count = -1;
-	while (1) {
-        getline(file, line);
-		std::istringstream iss{ line };
-		std::string first;
-		if (!(iss >> first)) {
-			std::cout << "Error 1 reading ply-header" << std::endl;
-			return nullptr;
-		}
-        if (first == "element") {
-			std::string second;
-			if (!(iss >> second)) {
-				std::cout << "Error reading second field of 'element'" << std::endl;
-				return nullptr;
-			}
-            if (second == "vertex") {
-				if (!(iss >> vertex_count)) {
-					std::cout << "Error 2 reading ply-header (vertex count)" << std::endl;
-					return nullptr;
-				}
-				if (vertex_count <= 0) {
-					std::cout << "Error reading ply-header: invalid vertex count" << std::endl;
-				}
-			}
-			else if (second == "face")
-			{
-				if (!(iss >> face_count)) {
-					std::cout << "Error 3 reading ply-header (face count)" << std::endl;
-					return nullptr;
-				}
-				if (face_count <= 0) {
-					std::cout << "Error reading ply-header: invalid face count" << std::endl;
-				}
-			}
-		}
-		else if (first == "end_header") {
-			break;
-		}
+	double distance; Vec2 uv;
+	bool found;
+	RenderStats* stats = RenderStats::current();
+	if (stats)
+		stats->triangle_tests_++;
+	if (baked_) {
+		const Face& f = level_data_->faces()[face];
+		found = MeshData::intersectTriangle(world_vertices_[f[0]].cast<double>(), world_vertices_[f[1]].cast<double>(), world_vertices_[f[2]].cast<double>(),
+			r, &distance, &uv);
 	}
-
-	if (vertex_count == -1 || face_count == -1) {
-		std::cout << "Error reading ply-header: vertex_count-error:" << (vertex_count==-1) << ", face_count-error:" << (face_count==-1) << std::endl;
-		return nullptr;
+	else {
+		Ray r_local{
+			(world2local_ * r.pos().homogeneous()).topRows(3),
+			world2local_.linear() * r.dir()
+		};
+		found = level_data_->calcTriIntersect(face, r_local, &distance, &uv);
 	}
+	if (!found || distance <= 0)
+		return false;
+	hit->distance_ = distance;
+	hit->t_ = distance;
+	hit->obj_ = this;
+	hit->primitive_ = face;
+	hit->u_ = uv[0];
+	hit->v_ = uv[1];
+	hit->material_ = -1;
+	return true;
+}
 
-	TriMesh *tm = new TriMesh{ tf, m, interpolate_normals };
-	tm->vertices_.resize(vertex_count);
-	tm->faces_.resize(face_count);
-
-	// Read Vertices
-	for (int i = 0; i < tm->vertices_.size(); i++) {
-        getline(file, line);
-		std::istringstream iss{ line };
-		int face_order[3] = { 0,1,2 };
-		if (reverse_face_normal) {
-			face_order[0] = 2;
-			face_order[2] = 0;
-		}
-		bool err = !(iss >> tm->vertices_[i](face_order[0]) >> tm->vertices_[i](face_order[1]) >> tm->vertices_[i](face_order[2]));
-		if (err) {
-			std::cout << "error reading vertex " << i << std::endl;
-			delete tm;
-			return nullptr;
+void TriMesh::resolve(const Ray & /*r*/, const Hit & hit, Intersection * is) const
+{
+	const MeshData& data = *level_data_;
+	const Face& f = data.faces()[hit.primitive_];
+	Vec3 point, normal;
+	if (baked_) {
+		const Vec3 A = world_vertices_[f[0]].cast<double>();
+		const Vec3 B = world_vertices_[f[1]].cast<double>();
+		const Vec3 C = world_vertices_[f[2]].cast<double>();
+		point = A + hit.u_ * (C - A) + hit.v_ * (B - A);
+
+		// Phong interpolation of the baked vertex normals
+		if (data.interpolateNormals()) {
+			normal = (1 - hit.u_ - hit.v_) * MeshData::decodeNormal(world_normals_[f[0]]) + hit.v_ * MeshData::decodeNormal(world_normals_[f[1]])
+				+ hit.u_ * MeshData::decodeNormal(world_normals_[f[2]]);
+			normal.normalize();
 		}
+		else
+			normal = orientation_ * (C - A).cross(B - A).normalized();
 	}
-
-	// Read Faces
-	for (int i = 0; i < tm->faces_.size(); i++) {
-        getline(file, line);
-		std::istringstream iss{ line };
-		int poly_number;
-		bool err = !(iss >> poly_number >> tm->faces_[i][0] >> tm->faces_[i][1] >> tm->faces_[i][2]);
-		if (err) {
-			std::cout << "error reading face " << i << std::endl;
-			delete tm;
-			return nullptr;
-		}
-		if (poly_number != 3) {
-			std::cout << "Unsupported Ply file, only triangular faces supported" << std::endl;
-			delete tm;
-			return nullptr;
-		}
+	else {
+		const Vec3 A = data.vertex(f[0]);
+		const Vec3 B = data.vertex(f[1]);
+		const Vec3 C = data.vertex(f[2]);
+		Vec3 local = A + hit.u_ * (C - A) + hit.v_ * (B - A);
+
+		// Calculate the interpolated normal at that point
+		if (data.interpolateNormals())
+			normal = data.calcPhongNormalInterpolation(hit.primitive_, hit.u_, hit.v_);
+		else
+			normal = data.faceNormal(hit.primitive_);
+
+		// Transform back to world coordinate frame
+		point = (tf_ * local.homogeneous()).topRows(3);
+		normal = (normal_matrix_ * normal).normalized();
 	}
 
-	tm->calcNormals();
-	tm->calcBoundingBox();
-	tm->tf_.translate(-tm->bounding_box_.center());
+	is->pos() = point;
+	is->distance() = hit.distance_;
+	is->obj() = this;
+	is->normal() = normal;
+}
 
-	return tm;
+void TriMesh::updateInverse()
+{
+	world2local_ = tf_.inverse();
+	Mat33 linear = tf_.matrix().topLeftCorner(3, 3);
+	normal_matrix_ = linear.inverse().transpose();
+	orientation_ = linear.determinant() < 0 ? -1 : 1;
 }
 
-bool TriMesh::calcTriIntersect(Index i, const Ray & r, Vec3 * point, double * distance) const
+void TriMesh::prepare()
 {
-	// Calculate (if it exists) the intersection point P on the plane defined by the triangle 
-	const Vec3& n = face_normals_[i];
-	double ray_on_normal_proj = r.dir().dot(n);
-	if (std::abs(ray_on_normal_proj) < EPS) {
-		// ray is in parallel of the plane, no intersection
-		return false;
+	updateInverse();
+	if (!isStatic()) {
+		baked_ = false;
+		world_vertices_ = std::vector<Vertex>{};
+		world_normals_ = std::vector<PackedNormal>{};
+		return;
 	}
-	//if (ray_on_normal_proj > 0) {
-	//	return false; // ray is coming from behind
-	//}
-	const Vec3& A = vertices_[faces_[i][0]];
-	const Vec3& B = vertices_[faces_[i][1]];
-	const Vec3& C = vertices_[faces_[i][2]];
-	*distance = (A.dot(n) - r.pos().dot(n)) / ray_on_normal_proj;
-	*point = r.pos() + *distance * r.dir();
-
-	//if (*distance < 0)
-	//	return false;
-
-	// Check if the intersection point is inside the triangle.
-	Eigen::Matrix<double,3,2> UV;
-	UV.col(0) = C - A;
-	UV.col(1) = B - A;
-	Vec2 x = (UV.transpose() * UV).ldlt().solve(UV.transpose() * (*point-A));
-	if ((x.array() < 0).any() || x.sum() > 1) {
-		// P is NOT inside the triangle.
-		return false;
+	const MeshData& data = *level_data_;
+	uint64_t key = Util::hash64(tf_.data(), sizeof(double) * 16, data.hash());
+	if (baked_ && key == baked_key_)
+		return;
+
+	const Vertices& vertices = data.vertices();
+	world_vertices_.resize(vertices.size());
+	AABB3 bounds;
+	for (size_t v = 0; v < vertices.size(); v++) {
+		Vec3 point = (tf_ * vertices[v].cast<double>().homogeneous()).topRows(3);
+		world_vertices_[v] = point.cast<float>();
+		bounds.extend(Vec3{ world_vertices_[v].cast<double>() });
 	}
-	return true;
+	world_normals_.clear();
+	if (data.interpolateNormals()) {
+		world_normals_.resize(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++)
+			world_normals_[v] = MeshData::encodeNormal((normal_matrix_ * MeshData::decodeNormal(data.vertexNormal(v))).normalized());
+	}
+	if (vertices.size() > 0) {
+		Vec3 half = bounds.sizes() / 2;
+		world_box_ = Box3{ bounds.center(), Vec3::UnitX(), Vec3::UnitY(), Vec3::UnitZ(), half.x(), half.y(), half.z() };
+	}
+	baked_ = true;
+	baked_key_ = key;
 }
 
-
-Vec3 TriMesh::calcPhongNormalInterpolation(Index i, const Vec3 & point) const
+void TriMesh::setStatic(bool is_static)
 {
-	const Vec3& A = vertices_[faces_[i][0]];
-	const Vec3& B = vertices_[faces_[i][1]];
-	const Vec3& C = vertices_[faces_[i][2]];
-
-	Vec3 u = C - A;
-	Vec3 v = B - A;
-	Vec3 w = point - A;
-	double area_total = u.cross(v).norm();
-	double gamma = w.cross(v).norm() / area_total;
-	double beta = u.cross(w).norm() / area_total;
-	double alpha = 1 - beta - gamma;
-
-	const Vec3& n_A = vertex_normals_[faces_[i][0]];
-	const Vec3& n_B = vertex_normals_[faces_[i][1]];
-	const Vec3& n_C = vertex_normals_[faces_[i][2]];
-
-	Vec3 n = alpha * n_A + beta * n_B + gamma * n_C;
-
-	n.normalize();
-	return n;
+	static_set_ = true;
+	static_ = is_static;
 }
 
-Vec3 TriMesh::calcTriNormal(Index i) const
+bool TriMesh::isStatic() const
 {
-	const Vec3& A = vertices_[faces_[i][0]];
-	const Vec3& B = vertices_[faces_[i][1]];
-	const Vec3& C = vertices_[faces_[i][2]];
-	Vec3 n = (C - A).cross(B - A);
-	return n;
+	return static_set_ ? static_ : data_.use_count() == 1;
 }
 
-void TriMesh::calcNormals()
+bool TriMesh::baked() const
 {
-	face_normals_.resize(faces_.size());
-	face_normals_unit_.resize(faces_.size());
-	for (int i = 0; i < faces_.size(); i++) {
-		face_normals_[i] = calcTriNormal(i);
-		face_normals_unit_[i] = face_normals_[i].normalized();
-	}
+	return baked_;
+}
 
-	// Calculate normals for each vertex
-	vertex_normals_.resize(vertices_.size());
-	for (int i = 0; i < vertices_.size(); i++) {
-		std::vector<Index> attached_faces; // faces that are connected to this vertex
-		findConnectedFaces(i, &attached_faces);
+const Vertices & TriMesh::vertices() const
+{
+	return level_data_->vertices();
+}
 
-		Vec3 mean_normal = Vec3::Zero();
-		for (int i = 0; i < attached_faces.size(); i++) {
-			mean_normal += face_normals_[attached_faces[i]];
-		}
-		mean_normal.normalize();
+const Faces & TriMesh::faces() const
+{
+	return level_data_->faces();
+}
 
-		vertex_normals_[i] = mean_normal;
-	}	
+const std::shared_ptr<const MeshData>& TriMesh::data() const
+{
+	return data_;
 }
 
-void TriMesh::findConnectedFaces(Index vertex, std::vector<Index>* connected_faces)
+void TriMesh::selectLevel(const Camera & cam)
 {
-	connected_faces->clear();
-	for (int i = 0; i < faces_.size(); i++) {
-		if (faces_[i][0] == vertex || faces_[i][1] == vertex || faces_[i][2] == vertex) {
-			connected_faces->push_back(i);
-		}
+	level_ = 0;
+	AABB2 pixels;
+	if (data_->levelCount() > 1 && cam.projectBoundsToPixels(worldBounds(), &pixels)) {
+		double area = pixels.volume();
+		while (level_ + 1 < data_->levelCount() && data_->level(level_ + 1).faces().size() >= area)
+			level_++;
 	}
+	level_data_ = &data_->level(level_);
 }
 
-void TriMesh::calcBoundingBox()
+int TriMesh::level() const
 {
-	const double MAX = std::numeric_limits<double>::max();
-	const double MIN = std::numeric_limits<double>::min();
-
-	// Find the center point
-	double max_x = MIN, max_y= MIN, max_z = MIN;
-	double min_x = MAX, min_y = MAX, min_z = MAX;
-	for (auto vertex = vertices_.begin(); vertex != vertices_.end(); vertex++) {
-		max_x = std::max(max_x, vertex->x());
-		max_y = std::max(max_y, vertex->y());
-		max_z = std::max(max_z, vertex->z());
-
-		min_x = std::min(min_x, vertex->x());
-		min_y = std::min(min_y, vertex->y());
-		min_z = std::min(min_z, vertex->z());
-	}
+	return level_;
+}
 
-	Vec3 center; 
-	center.x() = (max_x + min_x) / 2;
-	center.y() = (max_y + min_y) / 2;
-	center.z() = (max_z + min_z) / 2;
+uint64_t TriMesh::hash(uint64_t seed) const
+{
+	seed = SceneObject::hash(seed);
+	uint64_t data_hash = level_data_->hash();
+	return Util::hash64(&data_hash, sizeof(data_hash), seed);
+}
 
-	Vec3 u{
-		1, 0, 0
-	};
-	Vec3 v{
-		0, 1, 0
-	};
-	Vec3 w{
-		0, 0, 1
-	};
-	double length_u = max_x - center.x();
-	double length_v = max_y - center.y();
-	double length_w = max_z - center.z();
+Box3 TriMesh::localBounds() const
+{
+	return data_->boundingBox();
+}
 
-	bounding_box_ = Box3{ center, u, v, w, length_u, length_v, length_w };
+TriMesh* TriMesh::createPyramid(const SE3 & tf, const Material & m)
+{
+	return new TriMesh{ tf, m, MeshData::createPyramid() };
 }
 
-bool TriMesh::intersectBoundingBox(const Ray & r_local) const
+TriMesh * TriMesh::loadFromPly(const char * path, bool reverse_face_normal, const SE3& tf, const Material& m, bool interpolate_normals, int threads, const std::string& cache_dir,
+	bool reorder_faces, int lod_levels)
 {
-	return bounding_box_.intersect(r_local);
+	std::shared_ptr<MeshData> data = MeshData::loadFromPly(path, reverse_face_normal, interpolate_normals, threads, cache_dir, reorder_faces, lod_levels);
+	if (!data)
+		return nullptr;
+	return new TriMesh{ tf, m, data };
 }
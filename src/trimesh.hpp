@@ -1,67 +1,85 @@
 #pragma once
 #include <Eigen/Dense>
+#include <memory>
+#include <string>
 #include <vector>
-#include <array>
 #include "sceneobject.hpp"
 #include "box3.hpp"
+#include "meshdata.hpp"
 
 
 namespace TriangularMesh {
 
-	using Index = int;
-	using Vertex = Eigen::Vector3d;
-	using Vertices = std::vector<Vertex>;
-	using Face = std::array<Index, 3>;
-	using Faces = std::vector<Face>;
-
 
+/// @brief Instance of a triangle mesh: a transform and a material, the geometry is shared with all other instances of the same MeshData.
+/// The mesh is placed with the center of its bounding box at the origin of the transform.
+/// Of meshes with levels of detail the one selected for the frame is used for all rays, faces and vertices refer to it.
+/// Static meshes are baked into world coordinates once and intersected with world rays directly, others transform every ray.
+/// Baking costs a world copy of the geometry per instance, by default only instances not sharing their geometry are static.
 class TriMesh :
 	public SceneObject
 {
 public:
-	TriMesh(const SE3& tf, const Material& m, bool interpolate_normals);
+	TriMesh(const SE3& tf, const Material& m, std::shared_ptr<const MeshData> data);
 	virtual ~TriMesh();
 
-	virtual bool intersect(const Ray& r, Intersection* is) const;
+	virtual bool hit(const Ray& r, Hit* hit) const;
+	virtual void resolve(const Ray& r, const Hit& hit, Intersection* is) const;
 
-	static TriMesh* createPyramid(const SE3& tf, const Material& m);
+	virtual uint64_t hash(uint64_t seed) const;
 
-	static TriMesh* loadFromPly(const char* path, bool reverse_face_normal, const SE3&tf, const Material& m, bool interpolate_normals);
+	virtual Box3 localBounds() const;
 
-protected:
-	// Calculate the intersection point of a ray inside a triangle 
-	bool calcTriIntersect(Index i, const Ray& r_local, Vec3 *point, double *distance) const;
+	// Hit of a ray with a single face, used when the visible face is already known
+	bool hitFace(Index face, const Ray& r, Hit* hit) const;
 
-	// Interpolate the normal inside a triangle using Phong interpolation
-	Vec3 calcPhongNormalInterpolation(Index i, const Vec3& point) const;
+	const Vertices& vertices() const;
+	const Faces& faces() const;
+	const std::shared_ptr<const MeshData>& data() const;
 
-	// Calculate the normal of a triangle
-	Vec3 calcTriNormal(Index i) const;
+	// Choose the coarsest level of detail with at least one face per pixel covered by the projected bounding box, called once per frame.
+	// The full mesh is used if the box is not completely in front of the camera.
+	void selectLevel(const Camera& cam);
+	int level() const;
 
-	// Calculate the normals at all vertices. We need to do this before for Phong interpolation.
-	void calcNormals();
+	// Called once per frame after selectLevel() and before any hit(): static meshes transform the vertices and normals of the level into
+	// world coordinates, again only after the transform or the level changed. Others keep the inverse transform for the rays.
+	void prepare();
 
-	// Find all faces that are connected to a vertex
-	void findConnectedFaces(Index vertex, std::vector<Index>* connected_faces);
+	// Every static instance holds its own world copy of 16 bytes per vertex, which makes its rays cheaper but undoes the sharing
+	// of the geometry. Unless set here a mesh is static while it holds the only reference to its MeshData, so the memory of
+	// assets used many times still scales with the number of assets and not with the number of instances.
+	void setStatic(bool is_static);
+	bool isStatic() const;
+	bool baked() const;
 
-	// Calculate a bounding box which is including all vertices
-	void calcBoundingBox();
+	static TriMesh* createPyramid(const SE3& tf, const Material& m);
 
-	// Check if a local ray intersects the bounding box
-	bool intersectBoundingBox(const Ray& r_local) const;
+	// Load a mesh for a single instance, see MeshData::loadFromPly(). Use a MeshCache to share meshes loaded several times.
+	static TriMesh* loadFromPly(const char* path, bool reverse_face_normal, const SE3&tf, const Material& m, bool interpolate_normals, int threads = 1,
+		const std::string& cache_dir = "", bool reorder_faces = false, int lod_levels = 0);
 
 private:
-	Vertices vertices_;
-	Faces faces_;
-	std::vector<Vec3> vertex_normals_;
-	std::vector<Vec3> face_normals_;
-	std::vector<Vec3> face_normals_unit_;
-	Box3 bounding_box_;
-	bool interpolate_normals_;
+	// Inverse transform, normal matrix and orientation from the transform
+	void updateInverse();
+
+	std::shared_ptr<const MeshData> data_;
+	int level_;
+	const MeshData* level_data_; // data_->level(level_)
 
+	bool static_set_; // by setStatic(), otherwise static_ is unused
+	bool static_;
+	bool baked_;
+	uint64_t baked_key_; // of transform and level
+	std::vector<Vertex> world_vertices_;
+	std::vector<PackedNormal> world_normals_;
+	Box3 world_box_;
 
+	SE3 world2local_;
+	Mat33 normal_matrix_; // local to world, inverse transpose of the linear part
+	double orientation_; // -1 if the transform mirrors, faces are turned around then
 
 }; // class TriMesh
 
 
-}; // namespace TriMesh
\ No newline at end of file
+}; // namespace TriMesh
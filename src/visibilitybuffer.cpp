@@ -0,0 +1,168 @@
+#include "visibilitybuffer.hpp"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace TriangularMesh;
+
+// Twice the signed area of the triangle a, b, p in pixel coordinates
+static double edgeFunction(const Vec3& a, const Vec3& b, double px, double py)
+{
+	return (b.x() - a.x()) * (py - a.y()) - (b.y() - a.y()) * (px - a.x());
+}
+
+VisibilityBuffer::VisibilityBuffer() :
+	offset_x_{ 0 }, offset_y_{ 0 }, width_{ 0 }, height_{ 0 }, tile_width_{ 1 }, tile_height_{ 1 }, count_x_{ 0 }, scene_{ nullptr }
+{
+}
+
+void VisibilityBuffer::prepare(const Camera & cam, const Scene & scene, int offset_x, int offset_y, int width, int height, int tile_width, int tile_height)
+{
+	world2cam_ = cam.transform().inverse();
+	offset_x_ = offset_x;
+	offset_y_ = offset_y;
+	width_ = width;
+	height_ = height;
+	tile_width_ = tile_width;
+	tile_height_ = tile_height;
+	count_x_ = 1 + (width - 1) / tile_width;
+	int count_y = 1 + (height - 1) / tile_height;
+
+	scene_ = &scene;
+	meshes_.clear();
+	rasterised_.assign(scene.meshCount(), false);
+	tiles_.assign(width > 0 && height > 0 ? count_x_ * count_y : 0, std::vector<Triangle>{});
+
+	for (int m = 0; m < scene.meshCount(); m++) {
+		const TriMesh* mesh = scene.mesh(m);
+
+		// Primary rays start on the image plane at depth 1, meshes reaching in front of it are ray cast
+		SE3 local2cam = world2cam_ * mesh->transform();
+		ProjectedMesh projected;
+		projected.index_ = m;
+		projected.vertices_.reserve(mesh->vertices().size());
+		bool in_front = true;
+		for (auto v = mesh->vertices().begin(); v != mesh->vertices().end() && in_front; v++) {
+			Vec3 point = (local2cam * v->cast<double>().homogeneous()).topRows(3);
+			in_front = point[2] > 1 + 1e-9;
+			Vec3 pixel = cam.projectionMatrix() * (point / point[2]);
+			projected.vertices_.push_back(Vec3{ pixel[0], pixel[1], point[2] });
+		}
+		if (!in_front)
+			continue;
+
+		int mesh_index = static_cast<int>(meshes_.size());
+		meshes_.push_back(projected);
+		rasterised_[m] = true;
+
+		const std::vector<Vec3>& vertices = meshes_.back().vertices_;
+		for (int f = 0; f < static_cast<int>(mesh->faces().size()); f++) {
+			const Face& face = mesh->faces()[f];
+			const Vec3& a = vertices[face[0]];
+			const Vec3& b = vertices[face[1]];
+			const Vec3& c = vertices[face[2]];
+
+			// Pixel rectangle relative to the crop window, degenerate triangles cannot be hit
+			if (std::abs(edgeFunction(a, b, c.x(), c.y())) < EPS)
+				continue;
+			double min_x = std::min({ a.x(), b.x(), c.x() }) - offset_x_;
+			double max_x = std::max({ a.x(), b.x(), c.x() }) - offset_x_;
+			double min_y = std::min({ a.y(), b.y(), c.y() }) - offset_y_;
+			double max_y = std::max({ a.y(), b.y(), c.y() }) - offset_y_;
+			if (max_x < 0 || max_y < 0 || min_x > width_ - 1 || min_y > height_ - 1)
+				continue;
+
+			int tile_min_x = static_cast<int>(std::max(0.0, min_x)) / tile_width_;
+			int tile_max_x = static_cast<int>(std::min(width_ - 1.0, max_x)) / tile_width_;
+			int tile_min_y = static_cast<int>(std::max(0.0, min_y)) / tile_height_;
+			int tile_max_y = static_cast<int>(std::min(height_ - 1.0, max_y)) / tile_height_;
+			for (int y = tile_min_y; y <= tile_max_y; y++) {
+				for (int x = tile_min_x; x <= tile_max_x; x++)
+					tiles_[y * count_x_ + x].push_back(Triangle{ mesh_index, f });
+			}
+		}
+	}
+}
+
+void VisibilityBuffer::render(int tile, int start_x, int end_x, int start_y, int end_y, const ArenaVector<Ray>& rays, const Scene::Selection & candidates, Arena* scratch, ArenaVector<Intersection>* hits) const
+{
+	const double MAX = std::numeric_limits<double>::max();
+	const double TOLERANCE = 1e-7; // pixels on the border are resolved exactly afterwards
+	const int w = end_x - start_x;
+	const int n = w * (end_y - start_y);
+	assert(static_cast<int>(rays.size()) == n);
+
+	ArenaVector<double> depth_buffer(n, MAX, scratch);
+	ArenaVector<Hit> closest(n, Hit{}, scratch);
+	ArenaVector<Triangle> visible(n, Triangle{ -1, -1 }, scratch);
+	for (int i = 0; i < n; i++)
+		closest[i].distance_ = MAX;
+
+	// Objects which are not rasterised are ray cast
+	Scene::Selection ray_cast = candidates;
+	ray_cast.meshes_.clear();
+	for (auto m = candidates.meshes_.begin(); m != candidates.meshes_.end(); m++) {
+		if (!rasterised_[*m])
+			ray_cast.meshes_.push_back(*m);
+	}
+	if (!ray_cast.spheres_.empty() || !ray_cast.meshes_.empty() || !ray_cast.others_.empty()) {
+		for (int i = 0; i < n; i++) {
+			if (scene_->closestHit(rays[i], &closest[i], &ray_cast))
+				depth_buffer[i] = depth(rays[i].pos() + closest[i].distance_ * rays[i].dir());
+		}
+	}
+
+	// Z-buffer the triangles, pixel centers are at integer coordinates of the frame
+	const std::vector<Triangle>& triangles = tiles_[tile];
+	for (auto tri = triangles.begin(); tri != triangles.end(); tri++) {
+		const ProjectedMesh& mesh = meshes_[tri->mesh_];
+		const Face& face = scene_->mesh(mesh.index_)->faces()[tri->face_];
+		const Vec3& a = mesh.vertices_[face[0]];
+		const Vec3& b = mesh.vertices_[face[1]];
+		const Vec3& c = mesh.vertices_[face[2]];
+		double area = edgeFunction(a, b, c.x(), c.y());
+
+		int x0 = std::max(start_x, static_cast<int>(std::ceil(std::min({ a.x(), b.x(), c.x() }) - offset_x_)));
+		int x1 = std::min(end_x - 1, static_cast<int>(std::floor(std::max({ a.x(), b.x(), c.x() }) - offset_x_)));
+		int y0 = std::max(start_y, static_cast<int>(std::ceil(std::min({ a.y(), b.y(), c.y() }) - offset_y_)));
+		int y1 = std::min(end_y - 1, static_cast<int>(std::floor(std::max({ a.y(), b.y(), c.y() }) - offset_y_)));
+		for (int y = y0; y <= y1; y++) {
+			double py = offset_y_ + y;
+			for (int x = x0; x <= x1; x++) {
+				double px = offset_x_ + x;
+				double wa = edgeFunction(b, c, px, py) / area;
+				double wb = edgeFunction(c, a, px, py) / area;
+				double wc = 1 - wa - wb;
+				if (wa < -TOLERANCE || wb < -TOLERANCE || wc < -TOLERANCE)
+					continue;
+
+				// 1/depth is affine in pixel coordinates
+				double d = 1 / (wa / a.z() + wb / b.z() + wc / c.z());
+				int i = (y - start_y) * w + x - start_x;
+				if (d < depth_buffer[i]) {
+					depth_buffer[i] = d;
+					visible[i] = *tri;
+				}
+			}
+		}
+	}
+
+	// Exact hit with the visible triangle, pixels on its border which the ray misses are ray cast completely
+	hits->assign(n, Intersection{ Vec3::Zero(), Vec3::Zero(), MAX, nullptr });
+	for (int i = 0; i < n; i++) {
+		if (visible[i].mesh_ >= 0) {
+			int m = meshes_[visible[i].mesh_].index_;
+			if (scene_->mesh(m)->hitFace(visible[i].face_, rays[i], &closest[i]))
+				closest[i].material_ = scene_->meshMaterial(m);
+			else
+				scene_->closestHit(rays[i], &closest[i], &candidates);
+		}
+		if (closest[i].distance_ < MAX)
+			scene_->resolve(rays[i], closest[i], &(*hits)[i]);
+	}
+}
+
+double VisibilityBuffer::depth(const Vec3 & point) const
+{
+	return (world2cam_ * point.homogeneous())[2];
+}
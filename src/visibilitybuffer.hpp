@@ -0,0 +1,47 @@
+#pragma once
+#include "global.hpp"
+#include "camera.hpp"
+#include "scene.hpp"
+#include <vector>
+
+/// @brief Primary visibility by rasterisation instead of tracing primary rays.
+/// The triangles of all meshes are projected once per frame and sorted into tiles, every tile is then z-buffered on its own.
+/// Objects which cannot be rasterised, spheres and meshes reaching in front of the image plane, are ray cast per pixel and take part in the depth test.
+class VisibilityBuffer
+{
+public:
+	VisibilityBuffer();
+
+	// Project all meshes and sort their triangles into the tiles of the given size covering the crop window
+	void prepare(const Camera& cam, const Scene& scene, int offset_x, int offset_y, int width, int height, int tile_width, int tile_height);
+
+	// Closest hit of the primary ray of every pixel [start_x,end_x) x [start_y,end_y) of the crop window, which has to be the given tile.
+	// rays are the primary rays of the pixels row by row, pixels without a hit get the distance std::numeric_limits<double>::max().
+	// Temporary buffers are taken from scratch.
+	void render(int tile, int start_x, int end_x, int start_y, int end_y, const ArenaVector<Ray>& rays, const Scene::Selection& candidates, Arena* scratch, ArenaVector<Intersection>* hits) const;
+
+private:
+	// Depth along the optical axis of the camera
+	double depth(const Vec3& point) const;
+
+	struct ProjectedMesh {
+		int index_; // in the scene
+		std::vector<Vec3> vertices_; // pixel x, pixel y and depth
+	};
+
+	struct Triangle {
+		int mesh_;
+		int face_;
+	};
+
+	SE3 world2cam_;
+	int offset_x_, offset_y_;
+	int width_, height_;
+	int tile_width_, tile_height_;
+	int count_x_;
+
+	const Scene* scene_;
+	std::vector<ProjectedMesh> meshes_;
+	std::vector<bool> rasterised_; // for each mesh of the scene
+	std::vector<std::vector<Triangle>> tiles_; // triangles overlapping each tile
+};